@@ -1,14 +1,59 @@
 
 #include <quill.h>
+#include <string.h>
 #include <stddef.h>
 
+// All regions are aligned to their size, meaning the region of a slab
+// can be found by rounding its address down.
+#define REGION_SIZE ((size_t) 1 << 19)
+
+#ifndef _WIN32
+    #include <sys/mman.h>
+    #include <unistd.h>
+#endif
+
+// Mappings are made in whole pages, which are larger than 4 KiB on some
+// systems (like 16 KiB on arm64 macOS).
+static size_t page_size(void) {
+    static _Atomic(size_t) cached = 0;
+    size_t size = atomic_load_explicit(&cached, memory_order_relaxed);
+    if(size != 0) { return size; }
+    #ifdef _WIN32
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        size = (size_t) info.dwPageSize;
+    #else
+        size = (size_t) sysconf(_SC_PAGESIZE);
+    #endif
+    atomic_store_explicit(&cached, size, memory_order_relaxed);
+    return size;
+}
+
+static size_t round_to_pages(size_t size) {
+    size_t pagesize = page_size();
+    return (size + pagesize - 1) & ~(pagesize - 1);
+}
+
 #ifdef _WIN32
     static void *win_alloc(size_t size) {
-        return VirtualAlloc(
-            NULL, size,
-            MEM_COMMIT | MEM_RESERVE,
-            PAGE_READWRITE
-        );
+        for(;;) {
+            uint8_t *reserved = VirtualAlloc(
+                NULL, size + REGION_SIZE,
+                MEM_RESERVE,
+                PAGE_NOACCESS
+            );
+            if(reserved == NULL) { return NULL; }
+            uintptr_t aligned = ((uintptr_t) reserved + REGION_SIZE - 1)
+                & ~(REGION_SIZE - 1);
+            VirtualFree(reserved, 0, MEM_RELEASE);
+            // another thread may map the range in the meantime - retry then
+            void *ptr = VirtualAlloc(
+                (void *) aligned, size,
+                MEM_COMMIT | MEM_RESERVE,
+                PAGE_READWRITE
+            );
+            if(ptr != NULL) { return ptr; }
+        }
     }
 
     static void win_free(void* ptr, size_t size) {
@@ -16,261 +61,1169 @@
         VirtualFree(ptr, 0, MEM_RELEASE);
     }
 
+    // keeps the first page, which holds the region header
+    static void win_decommit(void *ptr, size_t size) {
+        size_t pagesize = page_size();
+        VirtualAlloc(
+            ((uint8_t *) ptr) + pagesize, size - pagesize,
+            MEM_RESET, PAGE_READWRITE
+        );
+    }
+
     #define REGION_ALLOC(n) win_alloc(n)
     #define REGION_FREE(p, n) win_free(p, n)
+    #define REGION_DECOMMIT(p, n) win_decommit(p, n)
 #else
-    #include <sys/mman.h>
-    #include <unistd.h>
-
     static void *mmap_alloc(size_t size) {
-        size_t pagesize = getpagesize();
-        size_t aligned_size = (size + pagesize - 1) & ~(pagesize - 1);
-        void *ptr = mmap(
-            NULL, aligned_size,
+        size_t aligned_size = round_to_pages(size);
+        uint8_t *ptr = mmap(
+            NULL, aligned_size + REGION_SIZE,
             PROT_READ | PROT_WRITE,
             MAP_PRIVATE | MAP_ANONYMOUS,
             -1, 0
         );
         if(ptr == MAP_FAILED) { return NULL; }
-        return ptr;
+        size_t lead = (REGION_SIZE - ((uintptr_t) ptr & (REGION_SIZE - 1)))
+            & (REGION_SIZE - 1);
+        if(lead > 0) { munmap(ptr, lead); }
+        munmap(ptr + lead + aligned_size, REGION_SIZE - lead);
+        return ptr + lead;
     }
 
     static void mmap_free(void* ptr, size_t size) {
-        size_t pagesize = getpagesize();
-        size_t aligned_size = (size + pagesize - 1) & ~(pagesize - 1);
-        munmap(ptr, aligned_size);
+        munmap(ptr, round_to_pages(size));
+    }
+
+    // keeps the first page, which holds the region header
+    static void mmap_decommit(void *ptr, size_t size) {
+        size_t pagesize = page_size();
+        madvise(((uint8_t *) ptr) + pagesize, size - pagesize, MADV_DONTNEED);
     }
 
     #define REGION_ALLOC(n) mmap_alloc(n)
     #define REGION_FREE(p, n) mmap_free(p, n)
-#endif
-
-#if __STDC_VERSION__ >= 202311L
-    // C23 - 'thread_local' is built-in
-#elif __STDC_VERSION__ >= 201112L
-    // C11 - 'thread_local' does not exist, but '_Thread_local' is built-in
-    #define thread_local _Thread_local
-#else
-    #error "Thread local storage must be supported"
+    #define REGION_DECOMMIT(p, n) mmap_decommit(p, n)
 #endif
 
 
 typedef struct quill_slab quill_slab_t;
+typedef struct quill_region quill_region_t;
+typedef struct quill_heap quill_heap_t;
 
-#define NO_CLASS -1
-
+// Slabs don't have a header - the link is only stored in unused slabs.
 typedef struct quill_slab {
-    int64_t class_i;
-    quill_slab_t *next; // for free lists
-    uint8_t data[];
+    quill_slab_t *next;
 } quill_slab_t;
 
-#define REGION_SLAB_COUNT 8192
+#define NO_CLASS -1
+#define ARENA_CLASS -2
 
 typedef struct quill_region {
+    int64_t class_i; // NO_CLASS for single allocations above MAX_SLAB_SIZE
+    size_t size;
+    size_t slab_c;
+    // NULL while the region is abandoned (in the global unused lists)
+    _Atomic(quill_heap_t *) owner;
+    quill_region_t *prev;
+    quill_region_t *next;
+    quill_bool_t full;
     size_t next_i;
-    uint8_t data[];
+    size_t live_c;
+    quill_slab_t *unused_next;
+    // slabs freed while the region had no owner
+    _Atomic(quill_slab_t *) abandoned_next;
+    _Atomic(void *) g_unused_next;
+    // regions that have been in a global unused list are never unmapped
+    quill_bool_t was_unused;
+    #ifdef QUILL_ALLOC_PROFILE
+        // number of live allocations recorded by the heap profiler
+        _Atomic(size_t) sampled_c;
+    #endif
 } quill_region_t;
 
+#define REGION_HEADER_SIZE ((sizeof(quill_region_t) + 63) & ~((size_t) 63))
+
+#define REGION_OF(p) \
+    ((quill_region_t *) ((uintptr_t) (p) & ~(REGION_SIZE - 1)))
+
+#define REGION_DATA(r) (((uint8_t *) (r)) + REGION_HEADER_SIZE)
+
 typedef struct quill_class {
     size_t slab_content_size;
+    // first region is the one currently allocated from
     quill_region_t *next;
-    quill_slab_t *unused_next;
+    quill_region_t *full_next;
+    // number of empty regions kept around other than the current one
+    size_t empty_c;
 } quill_class_t;
 
-typedef struct quill_class_unused {
-    _Atomic(uint64_t) count;
-    quill_mutex_t lock;
-    quill_slab_t *next;
-} quill_class_unused_t;
-
-#define CLASS_COUNT 6
-#define MAX_SLAB_SIZE 256
-
-static thread_local quill_class_t classes[CLASS_COUNT] = {
-    (quill_class_t) {
-        .slab_content_size = 8,
-        .next = NULL, .unused_next = NULL
-    },
-    (quill_class_t) {
-        .slab_content_size = 16,
-        .next = NULL, .unused_next = NULL
-    },
-    (quill_class_t) {
-        .slab_content_size = 32,
-        .next = NULL, .unused_next = NULL
-    },
-    (quill_class_t) {
-        .slab_content_size = 64,
-        .next = NULL, .unused_next = NULL
-    },
-    (quill_class_t) {
-        .slab_content_size = 128,
-        .next = NULL, .unused_next = NULL
-    },
-    (quill_class_t) {
-        .slab_content_size = MAX_SLAB_SIZE,
-        .next = NULL, .unused_next = NULL
-    }
+#define CLASS_COUNT QUILL_ALLOC_CLASS_COUNT
+#define MAX_SLAB_SIZE 32768
+
+#ifdef QUILL_ALLOC_STATS
+    // only written by the thread owning the heap
+    typedef struct quill_heap_stats {
+        _Atomic(uint64_t) alloc_c[CLASS_COUNT];
+        _Atomic(uint64_t) free_c[CLASS_COUNT];
+        _Atomic(uint64_t) remote_free_c;
+        _Atomic(uint64_t) global_fetch_c;
+        _Atomic(uint64_t) global_adopt_c;
+    } quill_heap_stats_t;
+
+    typedef struct quill_global_stats {
+        // slabs freed into regions without an owner
+        _Atomic(uint64_t) free_c[CLASS_COUNT];
+        _Atomic(uint64_t) heap_c;
+        _Atomic(uint64_t) region_map_c;
+        _Atomic(uint64_t) region_reuse_c;
+        _Atomic(uint64_t) region_release_c;
+        _Atomic(uint64_t) large_alloc_c;
+        _Atomic(uint64_t) large_free_c;
+        _Atomic(uint64_t) large_reuse_c;
+        _Atomic(uint64_t) large_size;
+    } quill_global_stats_t;
+#endif
+
+typedef struct quill_heap {
+    quill_class_t classes[CLASS_COUNT];
+    // slabs of owned regions freed by other threads
+    _Atomic(quill_slab_t *) remote_next;
+    _Atomic(void *) g_unused_next;
+    // all heaps that were ever created, for statistics
+    quill_heap_t *all_next;
+    #ifdef QUILL_ALLOC_STATS
+        quill_heap_stats_t stats;
+    #endif
+} quill_heap_t;
+
+// 'remote_next' of a heap that has been given up by its thread
+#define HEAP_CLOSED ((quill_slab_t *) 1)
+
+// Lock-free stack of regions or heaps. Both are aligned to REGION_SIZE,
+// so the lower bits of the top pointer hold a counter that prevents ABA.
+// Popping may read the link of an item that was just taken by another
+// thread, which is why nothing that was ever pushed is unmapped.
+typedef _Atomic(uintptr_t) quill_stack_t;
+
+#define STACK_TAG_MASK (REGION_SIZE - 1)
+#define STACK_ITEM(top) ((void *) ((top) & ~STACK_TAG_MASK))
+#define STACK_LINK(item, link_offset) \
+    ((_Atomic(void *) *) (((uint8_t *) (item)) + (link_offset)))
+
+typedef struct quill_unused {
+    quill_stack_t classes[CLASS_COUNT];
+    quill_stack_t heaps;
+    // released regions, mapped but without their memory
+    quill_stack_t decommitted;
+} quill_unused_t;
+
+#define REGION_LINK offsetof(quill_region_t, g_unused_next)
+#define HEAP_LINK offsetof(quill_heap_t, g_unused_next)
+
+// Steps of 8 bytes up to 64, then 4 classes between each power of two.
+static const size_t class_slab_content_size[CLASS_COUNT] = {
+    8, 16, 24, 32, 40, 48, 56, 64,
+    80, 96, 112, 128,
+    160, 192, 224, 256,
+    320, 384, 448, 512,
+    640, 768, 896, 1024,
+    1280, 1536, 1792, 2048,
+    2560, 3072, 3584, 4096,
+    5120, 6144, 7168, 8192,
+    10240, 12288, 14336, 16384,
+    20480, 24576, 28672, MAX_SLAB_SIZE
 };
 
-static quill_class_unused_t global_unused[CLASS_COUNT];
+// number of empty regions a heap may keep for each class before the memory
+// of additional empty regions is given back to the system
+#define DEFAULT_RETENTION 1
+
+static _Atomic(size_t) class_retention[CLASS_COUNT];
+
+static thread_local quill_heap_t *thread_heap = NULL;
+static thread_local size_t thread_released_size = 0;
+
+static _Atomic(quill_heap_t *) all_heaps = NULL;
+
+#ifdef QUILL_ALLOC_STATS
+    static quill_global_stats_t global_stats;
+
+    #define HEAP_STAT_ADD(heap, counter, n) atomic_store_explicit( \
+        &(heap)->stats.counter, \
+        atomic_load_explicit(&(heap)->stats.counter, memory_order_relaxed) \
+            + (n), \
+        memory_order_relaxed \
+    )
+    #define GLOBAL_STAT_ADD(counter, n) atomic_fetch_add_explicit( \
+        &global_stats.counter, (n), memory_order_relaxed \
+    )
+    #define GLOBAL_STAT_SUB(counter, n) atomic_fetch_sub_explicit( \
+        &global_stats.counter, (n), memory_order_relaxed \
+    )
+#else
+    #define HEAP_STAT_ADD(heap, counter, n) ((void) 0)
+    #define GLOBAL_STAT_ADD(counter, n) ((void) 0)
+    #define GLOBAL_STAT_SUB(counter, n) ((void) 0)
+#endif
+
+#ifdef QUILL_ALLOC_PROFILE
+    // bytes left to allocate until the next sample is taken
+    static thread_local int64_t thread_sample_countdown = 0;
+
+    // how often to check if profiling has been started in the meantime
+    #define PROFILE_CHECK_INTERVAL ((size_t) 1 << 20)
+#endif
+
+static quill_unused_t global_unused;
 
 void quill_alloc_init_global(void) {
     for(size_t class_i = 0; class_i < CLASS_COUNT; class_i += 1) {
-        quill_class_unused_t *g_unused = &global_unused[class_i];
-        atomic_store(&g_unused->count, 0);
-        quill_mutex_init(&g_unused->lock);
-        g_unused->next = NULL;
+        atomic_store(&global_unused.classes[class_i], 0);
+        atomic_store(&class_retention[class_i], DEFAULT_RETENTION);
     }
+    atomic_store(&global_unused.heaps, 0);
+    atomic_store(&global_unused.decommitted, 0);
 }
 
 void quill_alloc_destruct_global(void) {
-    for(size_t class_i = 0; class_i < CLASS_COUNT; class_i += 1) {
-        quill_class_unused_t *g_unused = &global_unused[class_i];
-        quill_mutex_destroy(&g_unused->lock);
+    // the global unused lists are lock-free - nothing to destroy
+}
+
+static void stack_push_chain(
+    quill_stack_t *stack, void *first, void *last, size_t link_offset
+) {
+    uintptr_t top = atomic_load_explicit(stack, memory_order_relaxed);
+    uintptr_t pushed;
+    do {
+        atomic_store_explicit(
+            STACK_LINK(last, link_offset), STACK_ITEM(top),
+            memory_order_relaxed
+        );
+        pushed = (uintptr_t) first | ((top + 1) & STACK_TAG_MASK);
+    } while(!atomic_compare_exchange_weak_explicit(
+        stack, &top, pushed, memory_order_release, memory_order_relaxed
+    ));
+}
+
+static void *stack_pop(quill_stack_t *stack, size_t link_offset) {
+    uintptr_t top = atomic_load_explicit(stack, memory_order_acquire);
+    for(;;) {
+        void *item = STACK_ITEM(top);
+        if(item == NULL) { return NULL; }
+        void *next = atomic_load_explicit(
+            STACK_LINK(item, link_offset), memory_order_relaxed
+        );
+        uintptr_t popped = (uintptr_t) next | ((top + 1) & STACK_TAG_MASK);
+        if(atomic_compare_exchange_weak_explicit(
+            stack, &top, popped, memory_order_acquire, memory_order_acquire
+        )) { return item; }
     }
 }
 
+static void *stack_take_all(quill_stack_t *stack) {
+    uintptr_t top = atomic_load_explicit(stack, memory_order_relaxed);
+    while(!atomic_compare_exchange_weak_explicit(
+        stack, &top, (top + 1) & STACK_TAG_MASK,
+        memory_order_acquire, memory_order_relaxed
+    )) {}
+    return STACK_ITEM(top);
+}
+
+static void stack_move_all(
+    quill_stack_t *from, quill_stack_t *to, size_t link_offset
+) {
+    void *first = stack_take_all(from);
+    if(first == NULL) { return; }
+    void *last = first;
+    for(;;) {
+        void *next = atomic_load_explicit(
+            STACK_LINK(last, link_offset), memory_order_relaxed
+        );
+        if(next == NULL) { break; }
+        last = next;
+    }
+    stack_push_chain(to, first, last, link_offset);
+}
+
 void *quill_alloc_get_unused(void) {
-    return (void *) ((quill_class_unused_t *) global_unused);
+    return (void *) &global_unused;
 }
 
-void quill_alloc_migrate_to(void *to_unused_raw) {
-    quill_class_unused_t *to_unused = (quill_class_unused_t *) to_unused_raw;
-    for(size_t class_i = 0; class_i < CLASS_COUNT; class_i += 1) {
-        quill_class_t *c = &classes[class_i];
-        quill_class_unused_t *g_unused = &to_unused[class_i];
-        quill_mutex_lock(&g_unused->lock);
-        size_t added_c = 0;
-        for(;;) {
-            quill_slab_t *transferred = c->unused_next;
-            if(transferred == NULL) { break; }
-            c->unused_next = transferred->next;
-            transferred->next = g_unused->next;
-            g_unused->next = transferred;
-            added_c += 1;
-        }
-        size_t slab_size = sizeof(quill_slab_t) + c->slab_content_size;
-        quill_region_t *region = c->next;
-        if(region != NULL) {
-            size_t slab_i = region->next_i;
-            for(; slab_i < REGION_SLAB_COUNT; slab_i += 1) {
-                quill_slab_t *added 
-                    = (quill_slab_t *) (region->data + (slab_i * slab_size));
-                added->next = g_unused->next;
-                g_unused->next = added;
-                added_c += 1;
+static void region_list_push(quill_region_t **list, quill_region_t *region) {
+    region->prev = NULL;
+    region->next = *list;
+    if(*list != NULL) { (*list)->prev = region; }
+    *list = region;
+}
+
+static void region_list_remove(quill_region_t **list, quill_region_t *region) {
+    if(region->prev != NULL) { region->prev->next = region->next; }
+    else { *list = region->next; }
+    if(region->next != NULL) { region->next->prev = region->prev; }
+    region->prev = NULL;
+    region->next = NULL;
+}
+
+static void release_region(quill_region_t *region) {
+    size_t size = region->size;
+    thread_released_size += size;
+    GLOBAL_STAT_ADD(region_release_c, 1);
+    if(!region->was_unused) {
+        REGION_FREE(region, size);
+        return;
+    }
+    REGION_DECOMMIT(region, size);
+    stack_push_chain(&global_unused.decommitted, region, region, REGION_LINK);
+}
+
+static void count_empty_regions(quill_class_t *c) {
+    c->empty_c = 0;
+    if(c->next == NULL) { return; }
+    quill_region_t *region = c->next->next;
+    for(; region != NULL; region = region->next) {
+        if(region->live_c == 0) { c->empty_c += 1; }
+    }
+}
+
+static void release_empty_regions(quill_class_t *c, size_t keep_c) {
+    quill_region_t *region = c->next;
+    while(region != NULL) {
+        quill_region_t *next = region->next;
+        if(region->live_c == 0) {
+            if(keep_c > 0) {
+                keep_c -= 1;
+            } else {
+                region_list_remove(&c->next, region);
+                release_region(region);
             }
         }
-        atomic_fetch_add(&g_unused->count, added_c);
-        quill_mutex_unlock(&g_unused->lock);
-    }
-}
-
-static const uint8_t size_class_of[MAX_SLAB_SIZE + 1] = {
-    // 0
-    0,
-    // 1..8
-    0, 0, 0, 0, 0, 0, 0, 0,
-    // 9..16
-    1, 1, 1, 1, 1, 1, 1, 1,
-    // 17..32
-    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
-    // 33..64
-    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
-    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
-    // 65..128
-    4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
-    4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
-    4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
-    4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
-    // 129, 256
-    5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
-    5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
-    5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
-    5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
-    5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
-    5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
-    5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
-    5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5
-};
+        region = next;
+    }
+    count_empty_regions(c);
+}
 
-#define G_UNUSED_BATCH_SIZE 16
+static void push_slab(_Atomic(quill_slab_t *) *list, quill_slab_t *slab) {
+    quill_slab_t *head = atomic_load_explicit(list, memory_order_relaxed);
+    do {
+        slab->next = head;
+    } while(!atomic_compare_exchange_weak_explicit(
+        list, &head, slab, memory_order_release, memory_order_relaxed
+    ));
+}
 
-static void fetch_global_unused(
-    quill_class_t *c, quill_class_unused_t *g_unused
+static void free_remote(quill_region_t *region, quill_slab_t *slab) {
+    for(;;) {
+        quill_heap_t *owner
+            = atomic_load_explicit(&region->owner, memory_order_acquire);
+        if(owner == NULL) {
+            GLOBAL_STAT_ADD(free_c[region->class_i], 1);
+            push_slab(&region->abandoned_next, slab);
+            return;
+        }
+        _Atomic(quill_slab_t *) *list = &owner->remote_next;
+        quill_slab_t *head = atomic_load_explicit(list, memory_order_relaxed);
+        for(;;) {
+            // owner is going away and already gave up the region - retry
+            if(head == HEAP_CLOSED) { break; }
+            slab->next = head;
+            if(atomic_compare_exchange_weak_explicit(
+                list, &head, slab, memory_order_release, memory_order_relaxed
+            )) { return; }
+        }
+    }
+}
+
+// Sends slabs with the same owner to it using a single operation.
+static void free_remote_chain(
+    quill_heap_t *owner, quill_slab_t *first, quill_slab_t *last
 ) {
-    quill_mutex_lock(&g_unused->lock);
-    size_t fetched_c = 0;
-    for(; fetched_c < G_UNUSED_BATCH_SIZE; fetched_c += 1) {
-        quill_slab_t *popped = g_unused->next;
-        if(popped == NULL) { break; }
-        g_unused->next = popped->next;
-        popped->next = c->unused_next;
-        c->unused_next = popped;
+    _Atomic(quill_slab_t *) *list = &owner->remote_next;
+    quill_slab_t *head = atomic_load_explicit(list, memory_order_relaxed);
+    while(head != HEAP_CLOSED) {
+        last->next = head;
+        if(atomic_compare_exchange_weak_explicit(
+            list, &head, first, memory_order_release, memory_order_relaxed
+        )) { return; }
+    }
+    // owner is going away - the regions now have a new owner or none
+    for(;;) {
+        quill_slab_t *next = first->next;
+        free_remote(REGION_OF(first), first);
+        if(first == last) { return; }
+        first = next;
     }
-    atomic_fetch_sub(&g_unused->count, fetched_c);
-    quill_mutex_unlock(&g_unused->lock);
 }
 
-static quill_slab_t *allocate_slab(size_t class_i, quill_class_t *c) {
-    size_t slab_size = sizeof(quill_slab_t) + c->slab_content_size;
-    quill_region_t *region = c->next;
-    if(region == NULL || region->next_i == REGION_SLAB_COUNT) {
-        region = REGION_ALLOC(
-            sizeof(quill_region_t) + (REGION_SLAB_COUNT * slab_size)
+static void free_local(
+    quill_heap_t *heap, quill_region_t *region, quill_slab_t *slab
+) {
+    slab->next = region->unused_next;
+    region->unused_next = slab;
+    region->live_c -= 1;
+    HEAP_STAT_ADD(heap, free_c[region->class_i], 1);
+    quill_class_t *c = &heap->classes[region->class_i];
+    if(region->full) {
+        region_list_remove(&c->full_next, region);
+        region->full = QUILL_FALSE;
+        // keep allocating from the current region if there is one
+        quill_region_t *current = c->next;
+        if(current == NULL) {
+            region_list_push(&c->next, region);
+        } else {
+            region->prev = current;
+            region->next = current->next;
+            if(current->next != NULL) { current->next->prev = region; }
+            current->next = region;
+        }
+        return;
+    }
+    if(region->live_c > 0 || region == c->next) { return; }
+    size_t retention = atomic_load_explicit(
+        &class_retention[region->class_i], memory_order_relaxed
+    );
+    if(c->empty_c < retention) {
+        c->empty_c += 1;
+        return;
+    }
+    region_list_remove(&c->next, region);
+    release_region(region);
+}
+
+static void collect_remote(quill_heap_t *heap) {
+    quill_slab_t *slab = atomic_exchange_explicit(
+        &heap->remote_next, NULL, memory_order_acquire
+    );
+    while(slab != NULL) {
+        quill_slab_t *next = slab->next;
+        quill_region_t *region = REGION_OF(slab);
+        HEAP_STAT_ADD(heap, remote_free_c, 1);
+        // the region may have been abandoned and adopted by another heap
+        // after the slab was sent to us
+        if(atomic_load_explicit(&region->owner, memory_order_relaxed) == heap) {
+            free_local(heap, region, slab);
+        } else {
+            free_remote(region, slab);
+        }
+        slab = next;
+    }
+}
+
+static void abandon_regions(quill_class_t *c, quill_stack_t *g_unused) {
+    quill_region_t *first = NULL;
+    quill_region_t *last = NULL;
+    quill_region_t *lists[2] = { c->next, c->full_next };
+    for(size_t list_i = 0; list_i < 2; list_i += 1) {
+        quill_region_t *region = lists[list_i];
+        while(region != NULL) {
+            quill_region_t *next = region->next;
+            atomic_store_explicit(&region->owner, NULL, memory_order_release);
+            region->prev = NULL;
+            region->next = NULL;
+            region->was_unused = QUILL_TRUE;
+            atomic_store_explicit(
+                &region->g_unused_next, first, memory_order_relaxed
+            );
+            if(last == NULL) { last = region; }
+            first = region;
+            region = next;
+        }
+    }
+    c->next = NULL;
+    c->full_next = NULL;
+    c->empty_c = 0;
+    if(first == NULL) { return; }
+    stack_push_chain(g_unused, first, last, REGION_LINK);
+}
+
+void quill_alloc_migrate_to(void *to_unused_raw) {
+    quill_unused_t *to_unused = (quill_unused_t *) to_unused_raw;
+    quill_heap_t *heap = thread_heap;
+    if(heap != NULL) {
+        collect_remote(heap);
+        for(size_t class_i = 0; class_i < CLASS_COUNT; class_i += 1) {
+            quill_class_t *c = &heap->classes[class_i];
+            release_empty_regions(c, atomic_load(&class_retention[class_i]));
+            abandon_regions(c, &to_unused->classes[class_i]);
+        }
+        // all regions are now ownerless, send anything that was freed
+        // in the meantime to the regions directly
+        quill_slab_t *slab = atomic_exchange_explicit(
+            &heap->remote_next, HEAP_CLOSED, memory_order_acquire
         );
+        while(slab != NULL) {
+            quill_slab_t *next = slab->next;
+            free_remote(REGION_OF(slab), slab);
+            slab = next;
+        }
+        stack_push_chain(&to_unused->heaps, heap, heap, HEAP_LINK);
+        thread_heap = NULL;
+    }
+    if(to_unused == &global_unused) { return; }
+    // a dynamically loaded runtime is going away - hand over everything
+    // that was given up by its other threads
+    for(size_t class_i = 0; class_i < CLASS_COUNT; class_i += 1) {
+        stack_move_all(
+            &global_unused.classes[class_i], &to_unused->classes[class_i],
+            REGION_LINK
+        );
+    }
+    stack_move_all(&global_unused.heaps, &to_unused->heaps, HEAP_LINK);
+    stack_move_all(
+        &global_unused.decommitted, &to_unused->decommitted, REGION_LINK
+    );
+}
+
+static quill_heap_t *acquire_heap(void) {
+    quill_heap_t *heap = stack_pop(&global_unused.heaps, HEAP_LINK);
+    if(heap == NULL) {
+        // heaps are never freed, since other threads may still send
+        // freed slabs to them
+        heap = REGION_ALLOC(sizeof(quill_heap_t));
+        if(heap == NULL) {
+            quill_panic(quill_string_from_static_cstr(
+                "Failed to allocate memory region\n"
+            ));
+        }
+        for(size_t class_i = 0; class_i < CLASS_COUNT; class_i += 1) {
+            heap->classes[class_i] = (quill_class_t) {
+                .slab_content_size = class_slab_content_size[class_i],
+                .next = NULL, .full_next = NULL, .empty_c = 0
+            };
+        }
+        // never removed, so a plain push can't run into ABA
+        heap->all_next = atomic_load_explicit(&all_heaps, memory_order_relaxed);
+        while(!atomic_compare_exchange_weak_explicit(
+            &all_heaps, &heap->all_next, heap,
+            memory_order_release, memory_order_relaxed
+        )) {}
+        GLOBAL_STAT_ADD(heap_c, 1);
+    }
+    atomic_store_explicit(&heap->remote_next, NULL, memory_order_release);
+    thread_heap = heap;
+    return heap;
+}
+
+static size_t floor_log2(size_t n) {
+    #if defined(__GNUC__) || defined(__clang__)
+        return (sizeof(unsigned long long) * 8 - 1)
+            - (size_t) __builtin_clzll((unsigned long long) n);
+    #else
+        size_t log = 0;
+        while(n >>= 1) { log += 1; }
+        return log;
+    #endif
+}
+
+static size_t size_class_of(size_t n) {
+    if(n <= 64) { return n == 0? 0 : (n - 1) >> 3; }
+    // 'n' is in (2^group, 2^(group + 1)], split into 4 steps
+    size_t group = floor_log2(n - 1);
+    size_t step = ((n - 1) >> (group - 2)) & 3;
+    return 8 + ((group - 6) << 2) + step;
+}
+
+static void collect_abandoned(quill_region_t *region) {
+    quill_slab_t *slab = atomic_exchange_explicit(
+        &region->abandoned_next, NULL, memory_order_acquire
+    );
+    while(slab != NULL) {
+        quill_slab_t *next = slab->next;
+        slab->next = region->unused_next;
+        region->unused_next = slab;
+        region->live_c -= 1;
+        slab = next;
+    }
+}
+
+static quill_region_t *fetch_global_unused(
+    quill_heap_t *heap, size_t class_i
+) {
+    quill_region_t *region = stack_pop(
+        &global_unused.classes[class_i], REGION_LINK
+    );
+    HEAP_STAT_ADD(heap, global_fetch_c, 1);
+    if(region == NULL) { return NULL; }
+    HEAP_STAT_ADD(heap, global_adopt_c, 1);
+    atomic_store_explicit(&region->owner, heap, memory_order_release);
+    // anything freed from now on is sent to our heap, which means we can
+    // safely take everything that was freed while the region was abandoned
+    collect_abandoned(region);
+    return region;
+}
+
+static quill_region_t *allocate_region(quill_heap_t *heap, size_t class_i) {
+    quill_region_t *region = stack_pop(&global_unused.decommitted, REGION_LINK);
+    if(region == NULL) {
+        region = REGION_ALLOC(REGION_SIZE);
         if(region == NULL) {
             quill_panic(quill_string_from_static_cstr(
-                "Failed to allocate memory region"
+                "Failed to allocate memory region\n"
             ));
         }
-        region->next_i = 0;
-        c->next = region;
+        region->was_unused = QUILL_FALSE;
+        GLOBAL_STAT_ADD(region_map_c, 1);
+    } else {
+        GLOBAL_STAT_ADD(region_reuse_c, 1);
     }
-    size_t slab_i = region->next_i;
-    quill_slab_t *slab = (quill_slab_t *) (region->data + (slab_i * slab_size));
-    region->next_i = slab_i + 1;
-    slab->class_i = class_i;
-    return slab;
+    region->class_i = class_i;
+    region->size = REGION_SIZE;
+    region->slab_c = (REGION_SIZE - REGION_HEADER_SIZE)
+        / heap->classes[class_i].slab_content_size;
+    atomic_store_explicit(&region->owner, heap, memory_order_relaxed);
+    region->prev = NULL;
+    region->next = NULL;
+    region->full = QUILL_FALSE;
+    region->next_i = 0;
+    region->live_c = 0;
+    region->unused_next = NULL;
+    atomic_store_explicit(&region->abandoned_next, NULL, memory_order_relaxed);
+    #ifdef QUILL_ALLOC_PROFILE
+        atomic_store_explicit(&region->sampled_c, 0, memory_order_relaxed);
+    #endif
+    return region;
 }
 
-void *quill_alloc_alloc(size_t n) {
-    if(n > MAX_SLAB_SIZE) {
-        quill_slab_t *slab = malloc(sizeof(quill_slab_t) + n);
-        slab->class_i = NO_CLASS;
-        return slab->data;
-    }
-    size_t class_i = size_class_of[n];
-    quill_class_t *c = &classes[class_i];
-    quill_slab_t *next = c->unused_next;
-    if(next != NULL) {
-        c->unused_next = next->next;
-        return next->data;
-    }
-    quill_class_unused_t *g_unused = &global_unused[class_i];
-    if(atomic_load(&g_unused->count) >= G_UNUSED_BATCH_SIZE) {
-        fetch_global_unused(c, g_unused);
-        next = c->unused_next;
+static quill_slab_t *take_slab(quill_class_t *c, quill_region_t *region) {
+    quill_slab_t *slab = region->unused_next;
+    if(slab != NULL) {
+        region->unused_next = slab->next;
+        region->live_c += 1;
+        return slab;
+    }
+    // frees that raced with the region being adopted by us
+    quill_slab_t *abandoned = atomic_load_explicit(
+        &region->abandoned_next, memory_order_relaxed
+    );
+    if(abandoned != NULL) {
+        collect_abandoned(region);
+        slab = region->unused_next;
+        if(slab != NULL) {
+            region->unused_next = slab->next;
+            region->live_c += 1;
+            return slab;
+        }
+    }
+    if(region->next_i < region->slab_c) {
+        slab = (quill_slab_t *) (
+            REGION_DATA(region) + (region->next_i * c->slab_content_size)
+        );
+        region->next_i += 1;
+        region->live_c += 1;
+        return slab;
+    }
+    return NULL;
+}
+
+static quill_slab_t *allocate_slab(quill_heap_t *heap, size_t class_i) {
+    quill_class_t *c = &heap->classes[class_i];
+    collect_remote(heap);
+    for(;;) {
+        quill_region_t *region = c->next;
+        if(region == NULL) { break; }
+        quill_slab_t *slab = take_slab(c, region);
+        if(slab != NULL) { return slab; }
+        region_list_remove(&c->next, region);
+        region_list_push(&c->full_next, region);
+        region->full = QUILL_TRUE;
+        // an empty region kept around is now the current one
+        if(c->next != NULL && c->next->live_c == 0) { c->empty_c -= 1; }
+    }
+    for(;;) {
+        quill_region_t *region = fetch_global_unused(heap, class_i);
+        if(region == NULL) { break; }
+        quill_slab_t *slab = take_slab(c, region);
+        if(slab != NULL) {
+            region_list_push(&c->next, region);
+            return slab;
+        }
+        region_list_push(&c->full_next, region);
+        region->full = QUILL_TRUE;
+    }
+    quill_region_t *region = allocate_region(heap, class_i);
+    region_list_push(&c->next, region);
+    return take_slab(c, region);
+}
+
+// Freed large allocations are kept for reuse by later ones of about the
+// same size, since mapping and unmapping them every time is a lot slower.
+// Allocations above LARGE_CACHE_MAX_SIZE are always unmapped right away.
+#define LARGE_CACHE_SLOT_C 16
+#define LARGE_CACHE_MAX_SIZE ((size_t) 1 << 22)
+#define LARGE_CACHE_MAX_TOTAL ((size_t) 1 << 25)
+
+typedef struct quill_large_cache {
+    quill_mutex_t lock;
+    // oldest first
+    quill_region_t *regions[LARGE_CACHE_SLOT_C];
+    size_t region_c;
+    size_t total_size;
+} quill_large_cache_t;
+
+static quill_large_cache_t large_cache;
+
+// The cache needs to be locked.
+static quill_region_t *uncache_large(size_t i) {
+    quill_large_cache_t *cache = &large_cache;
+    quill_region_t *region = cache->regions[i];
+    memmove(
+        cache->regions + i, cache->regions + i + 1,
+        sizeof(quill_region_t *) * (cache->region_c - i - 1)
+    );
+    cache->region_c -= 1;
+    cache->total_size -= region->size;
+    return region;
+}
+
+static quill_region_t *take_cached_large(size_t size) {
+    quill_large_cache_t *cache = &large_cache;
+    quill_mutex_lock(&cache->lock);
+    size_t found_i = cache->region_c;
+    for(size_t i = 0; i < cache->region_c; i += 1) {
+        size_t cached_size = cache->regions[i]->size;
+        // at most a quarter of the region may go unused
+        if(cached_size < size || cached_size - size > cached_size / 4) {
+            continue;
+        }
+        if(found_i == cache->region_c
+            || cached_size < cache->regions[found_i]->size) {
+            found_i = i;
+        }
+    }
+    quill_region_t *region = NULL;
+    if(found_i < cache->region_c) { region = uncache_large(found_i); }
+    quill_mutex_unlock(&cache->lock);
+    return region;
+}
+
+// Returns the regions that need to be unmapped, linked by 'next', which
+// are either 'region' itself or the oldest cached ones it replaced.
+static quill_region_t *cache_large(quill_region_t *region) {
+    region->next = NULL;
+    if(region->size > LARGE_CACHE_MAX_SIZE) { return region; }
+    quill_large_cache_t *cache = &large_cache;
+    quill_region_t *evicted = NULL;
+    quill_mutex_lock(&cache->lock);
+    while(cache->region_c == LARGE_CACHE_SLOT_C
+        || cache->total_size + region->size > LARGE_CACHE_MAX_TOTAL) {
+        quill_region_t *oldest = uncache_large(0);
+        oldest->next = evicted;
+        evicted = oldest;
+    }
+    cache->regions[cache->region_c] = region;
+    cache->region_c += 1;
+    cache->total_size += region->size;
+    quill_mutex_unlock(&cache->lock);
+    return evicted;
+}
+
+static void unmap_large(quill_region_t *region) {
+    while(region != NULL) {
+        quill_region_t *next = region->next;
+        thread_released_size += region->size;
+        REGION_FREE(region, region->size);
+        region = next;
+    }
+}
+
+static void release_large(quill_region_t *region) {
+    GLOBAL_STAT_ADD(large_free_c, 1);
+    GLOBAL_STAT_SUB(large_size, region->size);
+    unmap_large(cache_large(region));
+}
+
+static void *allocate_large(size_t n) {
+    size_t size = round_to_pages(REGION_HEADER_SIZE + n);
+    quill_region_t *region = take_cached_large(size);
+    if(region != NULL) {
+        GLOBAL_STAT_ADD(large_reuse_c, 1);
+    } else {
+        region = REGION_ALLOC(size);
+        if(region == NULL) { return NULL; }
+        region->size = size;
+    }
+    region->class_i = NO_CLASS;
+    #ifdef QUILL_ALLOC_PROFILE
+        atomic_store_explicit(&region->sampled_c, 0, memory_order_relaxed);
+    #endif
+    GLOBAL_STAT_ADD(large_alloc_c, 1);
+    GLOBAL_STAT_ADD(large_size, region->size);
+    return REGION_DATA(region);
+}
+
+static void *allocate(size_t n) {
+    if(n > MAX_SLAB_SIZE) { return allocate_large(n); }
+    quill_heap_t *heap = thread_heap;
+    if(heap == NULL) { heap = acquire_heap(); }
+    size_t class_i = size_class_of(n);
+    HEAP_STAT_ADD(heap, alloc_c[class_i], 1);
+    quill_region_t *region = heap->classes[class_i].next;
+    if(region != NULL) {
+        quill_slab_t *next = region->unused_next;
         if(next != NULL) {
-            c->unused_next = next->next;
-            return next->data;
+            region->unused_next = next->next;
+            region->live_c += 1;
+            return next;
         }
     }
-    return allocate_slab(class_i, c)->data;
+    return allocate_slab(heap, class_i);
+}
+
+#ifdef QUILL_ALLOC_PROFILE
+    static quill_bool_t profile_should_sample(void *alloc, size_t n) {
+        thread_sample_countdown -= (int64_t) n;
+        if(thread_sample_countdown >= 0) { return QUILL_FALSE; }
+        size_t interval = quill_profile_sample_interval();
+        if(interval == 0) {
+            thread_sample_countdown = (int64_t) PROFILE_CHECK_INTERVAL;
+            return QUILL_FALSE;
+        }
+        thread_sample_countdown = (int64_t) interval;
+        if(alloc == NULL) { return QUILL_FALSE; }
+        atomic_fetch_add_explicit(
+            &REGION_OF(alloc)->sampled_c, 1, memory_order_relaxed
+        );
+        return QUILL_TRUE;
+    }
+
+    static void profile_free(quill_region_t *region, void *alloc) {
+        if(region->class_i == ARENA_CLASS) { return; }
+        size_t sampled_c = atomic_load_explicit(
+            &region->sampled_c, memory_order_relaxed
+        );
+        if(sampled_c == 0 || !quill_profile_record_free(alloc)) { return; }
+        atomic_fetch_sub_explicit(&region->sampled_c, 1, memory_order_relaxed);
+    }
+#endif
+
+void *quill_alloc_alloc(size_t n) {
+    void *alloc = allocate(n);
+    #ifdef QUILL_ALLOC_PROFILE
+        // recorded from here so the captured stack starts with our caller
+        if(profile_should_sample(alloc, n)) {
+            quill_profile_record_alloc(alloc, n);
+        }
+    #endif
+    return alloc;
 }
 
 void quill_alloc_free(void *alloc) {
-    quill_slab_t *slab = (quill_slab_t *) (
-        ((uint8_t *) alloc) - offsetof(quill_slab_t, data)
-    );
-    size_t class_i = slab->class_i;
-    if(class_i == NO_CLASS) {
-        free(slab);
+    quill_slab_t *slab = (quill_slab_t *) alloc;
+    quill_region_t *region = REGION_OF(alloc);
+    #ifdef QUILL_ALLOC_PROFILE
+        profile_free(region, alloc);
+    #endif
+    if(region->class_i < 0) {
+        if(region->class_i == NO_CLASS) { release_large(region); }
+        // arena memory is only given back by 'quill_arena_pop'
         return;
     }
-    quill_class_t *c = &classes[class_i];
-    slab->next = c->unused_next;
-    c->unused_next = slab;
-}
\ No newline at end of file
+    quill_heap_t *heap = thread_heap;
+    quill_heap_t *owner
+        = atomic_load_explicit(&region->owner, memory_order_relaxed);
+    if(heap != NULL && owner == heap) {
+        free_local(heap, region, slab);
+    } else {
+        free_remote(region, slab);
+    }
+}
+
+void quill_alloc_free_batch(void **allocs, size_t n) {
+    quill_heap_t *heap = thread_heap;
+    quill_heap_t *chain_owner = NULL;
+    quill_slab_t *chain_first = NULL;
+    quill_slab_t *chain_last = NULL;
+    for(size_t i = 0; i < n; i += 1) {
+        quill_slab_t *slab = (quill_slab_t *) allocs[i];
+        quill_region_t *region = REGION_OF(slab);
+        if(region->class_i < 0) {
+            quill_alloc_free(slab);
+            continue;
+        }
+        #ifdef QUILL_ALLOC_PROFILE
+            profile_free(region, slab);
+        #endif
+        quill_heap_t *owner
+            = atomic_load_explicit(&region->owner, memory_order_acquire);
+        if(heap != NULL && owner == heap) {
+            free_local(heap, region, slab);
+            continue;
+        }
+        if(owner == NULL) {
+            free_remote(region, slab);
+            continue;
+        }
+        if(owner != chain_owner) {
+            if(chain_first != NULL) {
+                free_remote_chain(chain_owner, chain_first, chain_last);
+            }
+            chain_owner = owner;
+            chain_first = NULL;
+        }
+        slab->next = chain_first;
+        if(chain_first == NULL) { chain_last = slab; }
+        chain_first = slab;
+    }
+    if(chain_first != NULL) {
+        free_remote_chain(chain_owner, chain_first, chain_last);
+    }
+}
+
+static void trim_global_unused(quill_stack_t *g_unused) {
+    quill_region_t *region = stack_take_all(g_unused);
+    quill_region_t *kept_first = NULL;
+    quill_region_t *kept_last = NULL;
+    while(region != NULL) {
+        quill_region_t *next = atomic_load_explicit(
+            &region->g_unused_next, memory_order_relaxed
+        );
+        // the regions can't be adopted while we hold them, and once all
+        // slabs have been returned no other thread can still free into one
+        collect_abandoned(region);
+        if(region->live_c == 0) {
+            release_region(region);
+        } else {
+            atomic_store_explicit(
+                &region->g_unused_next, kept_first, memory_order_relaxed
+            );
+            if(kept_last == NULL) { kept_last = region; }
+            kept_first = region;
+        }
+        region = next;
+    }
+    if(kept_first == NULL) { return; }
+    stack_push_chain(g_unused, kept_first, kept_last, REGION_LINK);
+}
+
+static void trim_large_cache(void) {
+    quill_large_cache_t *cache = &large_cache;
+    quill_region_t *cached = NULL;
+    quill_mutex_lock(&cache->lock);
+    while(cache->region_c > 0) {
+        quill_region_t *region = uncache_large(cache->region_c - 1);
+        region->next = cached;
+        cached = region;
+    }
+    quill_mutex_unlock(&cache->lock);
+    unmap_large(cached);
+}
+
+size_t quill_alloc_trim(void) {
+    size_t released_before = thread_released_size;
+    quill_heap_t *heap = thread_heap;
+    if(heap != NULL) {
+        collect_remote(heap);
+        for(size_t class_i = 0; class_i < CLASS_COUNT; class_i += 1) {
+            release_empty_regions(&heap->classes[class_i], 0);
+        }
+    }
+    for(size_t class_i = 0; class_i < CLASS_COUNT; class_i += 1) {
+        trim_global_unused(&global_unused.classes[class_i]);
+    }
+    trim_large_cache();
+    return thread_released_size - released_before;
+}
+
+void quill_alloc_set_retention(size_t n, size_t region_c) {
+    if(n > MAX_SLAB_SIZE) { return; }
+    atomic_store(&class_retention[size_class_of(n)], region_c);
+}
+
+size_t quill_alloc_usable_size(size_t n) {
+    if(n > MAX_SLAB_SIZE) {
+        // large allocations are mapped in whole pages
+        return round_to_pages(REGION_HEADER_SIZE + n) - REGION_HEADER_SIZE;
+    }
+    return class_slab_content_size[size_class_of(n)];
+}
+
+static quill_alloc_stats_t empty_stats(void) {
+    quill_alloc_stats_t stats = { 0 };
+    for(size_t class_i = 0; class_i < CLASS_COUNT; class_i += 1) {
+        stats.classes[class_i].slab_size = class_slab_content_size[class_i];
+    }
+    return stats;
+}
+
+#ifdef QUILL_ALLOC_STATS
+    #define STAT_LOAD(counter) \
+        atomic_load_explicit(&(counter), memory_order_relaxed)
+
+    static void add_heap_stats(quill_alloc_stats_t *stats, quill_heap_t *heap) {
+        quill_heap_stats_t *h = &heap->stats;
+        for(size_t class_i = 0; class_i < CLASS_COUNT; class_i += 1) {
+            stats->classes[class_i].alloc_c += STAT_LOAD(h->alloc_c[class_i]);
+            stats->classes[class_i].free_c += STAT_LOAD(h->free_c[class_i]);
+        }
+        stats->remote_free_c += STAT_LOAD(h->remote_free_c);
+        stats->global_fetch_c += STAT_LOAD(h->global_fetch_c);
+        stats->global_adopt_c += STAT_LOAD(h->global_adopt_c);
+    }
+#endif
+
+quill_alloc_stats_t quill_alloc_stats(void) {
+    quill_alloc_stats_t stats = empty_stats();
+    #ifdef QUILL_ALLOC_STATS
+        quill_heap_t *heap
+            = atomic_load_explicit(&all_heaps, memory_order_acquire);
+        for(; heap != NULL; heap = heap->all_next) {
+            add_heap_stats(&stats, heap);
+        }
+        quill_global_stats_t *g = &global_stats;
+        for(size_t class_i = 0; class_i < CLASS_COUNT; class_i += 1) {
+            stats.classes[class_i].free_c += STAT_LOAD(g->free_c[class_i]);
+        }
+        stats.heap_c = STAT_LOAD(g->heap_c);
+        stats.region_map_c = STAT_LOAD(g->region_map_c);
+        stats.region_reuse_c = STAT_LOAD(g->region_reuse_c);
+        stats.region_release_c = STAT_LOAD(g->region_release_c);
+        stats.large_alloc_c = STAT_LOAD(g->large_alloc_c);
+        stats.large_free_c = STAT_LOAD(g->large_free_c);
+        stats.large_reuse_c = STAT_LOAD(g->large_reuse_c);
+        stats.large_size = STAT_LOAD(g->large_size);
+    #endif
+    return stats;
+}
+
+quill_alloc_stats_t quill_alloc_thread_stats(void) {
+    quill_alloc_stats_t stats = empty_stats();
+    #ifdef QUILL_ALLOC_STATS
+        quill_heap_t *heap = thread_heap;
+        if(heap != NULL) { add_heap_stats(&stats, heap); }
+    #endif
+    return stats;
+}
+
+
+typedef struct quill_arena_chunk quill_arena_chunk_t;
+
+// Starts with the class like a region, so that freeing arena memory
+// using 'quill_alloc_free' is a no-op.
+typedef struct quill_arena_chunk {
+    int64_t class_i;
+    size_t size;
+    quill_arena_chunk_t *prev;
+} quill_arena_chunk_t;
+
+#define ARENA_CHUNK_SIZE REGION_SIZE
+#define ARENA_ALIGN 16
+#define ARENA_ALIGN_UP(n) (((n) + ARENA_ALIGN - 1) & ~((size_t) ARENA_ALIGN - 1))
+#define ARENA_CHUNK_HEADER_SIZE ARENA_ALIGN_UP(sizeof(quill_arena_chunk_t))
+
+// Arena allocations with a destructor are prefixed with a link to the
+// previous one, so that 'quill_arena_pop' can call them.
+typedef struct quill_arena_destructed quill_arena_destructed_t;
+
+typedef struct quill_arena_destructed {
+    quill_arena_destructed_t *prev;
+    uint8_t padding[ARENA_ALIGN - sizeof(void *)];
+    quill_alloc_t alloc;
+} quill_arena_destructed_t;
+
+typedef struct quill_arena {
+    quill_arena_chunk_t *chunk;
+    uint8_t *next;
+    uint8_t *end;
+    quill_arena_destructed_t *destructed;
+    // last chunk given back by 'quill_arena_pop', kept for the next push
+    quill_arena_chunk_t *spare;
+} quill_arena_t;
+
+static thread_local quill_arena_t thread_arena = {
+    .chunk = NULL, .next = NULL, .end = NULL,
+    .destructed = NULL, .spare = NULL
+};
+
+quill_arena_mark_t quill_arena_push(void) {
+    quill_arena_t *arena = &thread_arena;
+    return (quill_arena_mark_t) {
+        .chunk = arena->chunk,
+        .next = arena->next,
+        .destructed = arena->destructed
+    };
+}
+
+static void release_arena_chunk(quill_arena_t *arena, quill_arena_chunk_t *c) {
+    if(c->size == ARENA_CHUNK_SIZE && arena->spare == NULL) {
+        arena->spare = c;
+        return;
+    }
+    REGION_FREE(c, c->size);
+}
+
+void quill_arena_pop(quill_arena_mark_t mark) {
+    quill_arena_t *arena = &thread_arena;
+    // destructors may still read other allocations, so call them first
+    while(arena->destructed != mark.destructed) {
+        quill_arena_destructed_t *destructed = arena->destructed;
+        arena->destructed = destructed->prev;
+        destructed->alloc.destructor(&destructed->alloc);
+    }
+    while(arena->chunk != mark.chunk) {
+        quill_arena_chunk_t *c = arena->chunk;
+        arena->chunk = c->prev;
+        release_arena_chunk(arena, c);
+    }
+    if(arena->chunk == NULL) {
+        arena->next = NULL;
+        arena->end = NULL;
+        return;
+    }
+    arena->next = mark.next;
+    arena->end = ((uint8_t *) arena->chunk) + arena->chunk->size;
+}
+
+static void grow_arena(quill_arena_t *arena, size_t n) {
+    size_t size = ARENA_CHUNK_HEADER_SIZE + n;
+    quill_arena_chunk_t *c;
+    if(size <= ARENA_CHUNK_SIZE && arena->spare != NULL) {
+        c = arena->spare;
+        arena->spare = NULL;
+    } else {
+        if(size < ARENA_CHUNK_SIZE) { size = ARENA_CHUNK_SIZE; }
+        c = REGION_ALLOC(size);
+        if(c == NULL) {
+            quill_panic(quill_string_from_static_cstr(
+                "Failed to allocate memory region\n"
+            ));
+        }
+        c->class_i = ARENA_CLASS;
+        c->size = size;
+    }
+    c->prev = arena->chunk;
+    arena->chunk = c;
+    arena->next = ((uint8_t *) c) + ARENA_CHUNK_HEADER_SIZE;
+    // chunks larger than a region only hold a single allocation, which
+    // keeps all arena memory in the first region of its chunk
+    arena->end = c->size == ARENA_CHUNK_SIZE
+        ? ((uint8_t *) c) + c->size
+        : arena->next + n;
+}
+
+void *quill_arena_alloc(size_t n) {
+    quill_arena_t *arena = &thread_arena;
+    n = ARENA_ALIGN_UP(n);
+    if((size_t) (arena->end - arena->next) < n) { grow_arena(arena, n); }
+    void *alloc = arena->next;
+    arena->next += n;
+    return alloc;
+}
+
+quill_alloc_t *quill_arena_malloc(size_t n, quill_destructor_t destructor) {
+    if(n == 0) { return NULL; }
+    quill_alloc_t *alloc;
+    if(destructor == NULL) {
+        alloc = quill_arena_alloc(sizeof(quill_alloc_t) + n);
+    } else {
+        quill_arena_destructed_t *destructed = quill_arena_alloc(
+            sizeof(quill_arena_destructed_t) + n
+        );
+        destructed->prev = thread_arena.destructed;
+        thread_arena.destructed = destructed;
+        alloc = &destructed->alloc;
+    }
+    atomic_store_explicit(
+        &alloc->rc, QUILL_RC_IMMORTAL_NEW, memory_order_relaxed
+    );
+    alloc->destructor = destructor;
+    return alloc;
+}
@@ -0,0 +1,132 @@
+#include <quill.h>
+#include <string.h>
+
+#define MIN_BUILDER_CAPACITY 64
+
+void quill_string_builder_reserve(
+    quill_string_builder_t *builder, size_t additional_bytes
+) {
+    size_t required = builder->length_bytes + additional_bytes;
+    if(required <= builder->capacity) { return; }
+    size_t capacity = builder->capacity * 2;
+    if(capacity < MIN_BUILDER_CAPACITY) { capacity = MIN_BUILDER_CAPACITY; }
+    if(capacity < required) { capacity = required; }
+    quill_alloc_t *alloc = quill_alloc_alloc(
+        sizeof(quill_alloc_t) + sizeof(quill_string_header_t) + capacity
+    );
+    if(alloc == NULL) {
+        quill_panic(quill_string_from_static_cstr(
+            "Unable to allocate memory\n"
+        ));
+    }
+    if(builder->alloc != NULL) {
+        memcpy(
+            quill_string_alloc_bytes(alloc),
+            quill_string_alloc_bytes(builder->alloc), builder->length_bytes
+        );
+        quill_alloc_free(builder->alloc);
+    }
+    builder->alloc = alloc;
+    builder->capacity = capacity;
+}
+
+static uint8_t *builder_end(quill_string_builder_t *builder) {
+    return quill_string_alloc_bytes(builder->alloc) + builder->length_bytes;
+}
+
+void quill_string_builder_append(
+    quill_string_builder_t *builder, quill_string_t s
+) {
+    if(s.length_bytes == 0) { return; }
+    quill_string_builder_reserve(builder, (size_t) s.length_bytes);
+    quill_string_copy_to(s, builder_end(builder));
+    builder->length_bytes += (size_t) s.length_bytes;
+    builder->length_points += s.length_points;
+}
+
+void quill_string_builder_append_point(
+    quill_string_builder_t *builder, uint32_t point
+) {
+    quill_int_t length_bytes = quill_point_encode_length(point);
+    quill_string_builder_reserve(builder, (size_t) length_bytes);
+    quill_point_encode(point, builder_end(builder));
+    builder->length_bytes += (size_t) length_bytes;
+    builder->length_points += 1;
+}
+
+void quill_string_builder_append_points(
+    quill_string_builder_t *builder,
+    const uint32_t *points, quill_int_t length_points
+) {
+    if(length_points == 0) { return; }
+    quill_int_t length_bytes
+        = quill_utf8_length_of_points(points, (size_t) length_points);
+    if(length_bytes < 0) {
+        // panics with the reason the point can't be encoded
+        for(quill_int_t i = 0; i < length_points; i += 1) {
+            quill_point_encode_length(points[i]);
+        }
+    }
+    quill_string_builder_reserve(builder, (size_t) length_bytes);
+    quill_utf8_encode(
+        points, (size_t) length_points,
+        builder_end(builder), (size_t) length_bytes
+    );
+    builder->length_bytes += (size_t) length_bytes;
+    builder->length_points += length_points;
+}
+
+// Numbers are formatted straight into the buffer. They are always ASCII,
+// meaning that each byte is one code point.
+
+void quill_string_builder_append_int(
+    quill_string_builder_t *builder, quill_int_t i
+) {
+    quill_string_builder_reserve(builder, QUILL_INT_FORMAT_MAX);
+    quill_int_t length_bytes = quill_int_format(i, builder_end(builder));
+    builder->length_bytes += (size_t) length_bytes;
+    builder->length_points += length_bytes;
+}
+
+void quill_string_builder_append_float(
+    quill_string_builder_t *builder, quill_float_t f
+) {
+    quill_string_builder_reserve(builder, QUILL_FLOAT_FORMAT_MAX);
+    quill_int_t length_bytes = quill_float_format(f, builder_end(builder));
+    builder->length_bytes += (size_t) length_bytes;
+    builder->length_points += length_bytes;
+}
+
+quill_string_t quill_string_builder_finish(quill_string_builder_t *builder) {
+    quill_string_t res = QUILL_EMPTY_STRING;
+    res.length_bytes = (quill_int_t) builder->length_bytes;
+    res.length_points = builder->length_points;
+    if(quill_string_is_inline(res)) {
+        if(builder->alloc != NULL) {
+            memcpy(
+                res.inline_data, quill_string_alloc_bytes(builder->alloc),
+                builder->length_bytes
+            );
+        }
+        quill_string_builder_free(builder);
+        return res;
+    }
+    size_t index_size
+        = quill_string_index_size(res.length_bytes, res.length_points);
+    // only grows the buffer if the index doesn't fit after the contents
+    quill_string_builder_reserve(builder, index_size);
+    // the buffer already has room for the headers of a string allocation
+    quill_alloc_t *alloc = builder->alloc;
+    atomic_store_explicit(&alloc->rc, QUILL_RC_NEW, memory_order_relaxed);
+    alloc->destructor = NULL;
+    quill_string_init_header(alloc, res.length_bytes, res.length_points);
+    res.alloc = alloc;
+    res.data = quill_string_alloc_bytes(alloc);
+    *builder = QUILL_EMPTY_STRING_BUILDER;
+    return res;
+}
+
+void quill_string_builder_free(quill_string_builder_t *builder) {
+    if(builder->alloc != NULL) { quill_alloc_free(builder->alloc); }
+    *builder = QUILL_EMPTY_STRING_BUILDER;
+}
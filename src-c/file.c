@@ -0,0 +1,310 @@
+#include <quill.h>
+#include <string.h>
+
+#ifdef _WIN32
+    #include <io.h>
+    #include <limits.h>
+    typedef HANDLE quill_file_t;
+    #define READ(fd, dest, n) \
+        ((long long) _read((fd), (dest), (unsigned int) ((n) > INT_MAX ? INT_MAX : (n))))
+#else
+    #include <unistd.h>
+    #include <errno.h>
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    typedef int quill_file_t;
+    #define READ(fd, dest, n) ((long long) read((fd), (dest), (n)))
+#endif
+
+// Smaller files are cheaper to read than to map.
+#define MIN_MAPPED_LENGTH 16384
+#define MIN_READ_CAPACITY 4096
+
+quill_unit_t quill_mapped_string_free(quill_alloc_t *alloc) {
+    quill_string_mapping_t *mapping
+        = (quill_string_mapping_t *) quill_string_alloc_bytes(alloc);
+    #ifdef _WIN32
+        UnmapViewOfFile(mapping->address);
+        CloseHandle(mapping->handle);
+    #else
+        munmap((void *) mapping->address, mapping->length);
+    #endif
+    return QUILL_UNIT;
+}
+
+// Returns the number of bytes read, 0 at the end of the file
+// and a negative number if the file can't be read.
+static long long read_some(quill_file_t file, uint8_t *dest, size_t n) {
+    #ifdef _WIN32
+        DWORD read_c;
+        DWORD requested = n > MAXDWORD ? MAXDWORD : (DWORD) n;
+        if(!ReadFile(file, dest, requested, &read_c, NULL)) { return -1; }
+        return (long long) read_c;
+    #else
+        for(;;) {
+            ssize_t read_c = read(file, dest, n);
+            if(read_c < 0 && errno == EINTR) { continue; }
+            return (long long) read_c;
+        }
+    #endif
+}
+
+static quill_bool_t string_from_read(
+    quill_file_t file, size_t length_hint, quill_string_t *dest
+) {
+    // one more byte than expected so that the end is found in one read
+    size_t capacity = length_hint + 1;
+    if(capacity < MIN_READ_CAPACITY) { capacity = MIN_READ_CAPACITY; }
+    uint8_t *buffer = malloc(capacity);
+    size_t length = 0;
+    for(;;) {
+        if(buffer == NULL) {
+            quill_panic(quill_string_from_static_cstr(
+                "Unable to allocate memory\n"
+            ));
+        }
+        long long read_c = read_some(file, buffer + length, capacity - length);
+        if(read_c < 0) {
+            free(buffer);
+            return QUILL_FALSE;
+        }
+        if(read_c == 0) { break; }
+        length += (size_t) read_c;
+        if(length == capacity) {
+            capacity *= 2;
+            buffer = realloc(buffer, capacity);
+        }
+    }
+    quill_int_t length_points = quill_utf8_validate(buffer, length);
+    quill_bool_t valid = length_points >= 0;
+    if(valid) {
+        *dest = quill_string_from_valid_utf8(
+            buffer, (quill_int_t) length, length_points
+        );
+    }
+    free(buffer);
+    return valid;
+}
+
+// Takes ownership of 'mapping', which is removed if the contents
+// aren't valid UTF-8.
+static quill_bool_t string_from_mapping(
+    quill_string_mapping_t mapping, quill_string_t *dest
+) {
+    quill_int_t length_points
+        = quill_utf8_validate(mapping.address, mapping.length);
+    quill_alloc_t *alloc = quill_malloc(
+        sizeof(quill_string_header_t) + sizeof(quill_string_mapping_t),
+        &quill_mapped_string_free
+    );
+    // there is no room for an index, so code points are always found by
+    // going through the contents
+    quill_string_init_header(
+        alloc, (quill_int_t) mapping.length, (quill_int_t) mapping.length
+    );
+    memcpy(quill_string_alloc_bytes(alloc), &mapping, sizeof(mapping));
+    if(length_points < 0) {
+        quill_rc_dec(alloc);
+        return QUILL_FALSE;
+    }
+    dest->alloc = alloc;
+    dest->data = mapping.address;
+    dest->length_bytes = (quill_int_t) mapping.length;
+    dest->length_points = length_points;
+    return QUILL_TRUE;
+}
+
+quill_bool_t quill_string_from_file(const char *path, quill_string_t *dest) {
+    #ifdef _WIN32
+        HANDLE file = CreateFileA(
+            path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL
+        );
+        if(file == INVALID_HANDLE_VALUE) { return QUILL_FALSE; }
+        LARGE_INTEGER size;
+        if(!GetFileSizeEx(file, &size)) {
+            CloseHandle(file);
+            return QUILL_FALSE;
+        }
+        size_t length = (size_t) size.QuadPart;
+        if(length < MIN_MAPPED_LENGTH) {
+            quill_bool_t res = string_from_read(file, length, dest);
+            CloseHandle(file);
+            return res;
+        }
+        HANDLE handle = CreateFileMappingA(
+            file, NULL, PAGE_READONLY, 0, 0, NULL
+        );
+        CloseHandle(file);
+        if(handle == NULL) { return QUILL_FALSE; }
+        const uint8_t *address = MapViewOfFile(handle, FILE_MAP_READ, 0, 0, 0);
+        if(address == NULL) {
+            CloseHandle(handle);
+            return QUILL_FALSE;
+        }
+        quill_string_mapping_t mapping = {
+            .address = address, .length = length, .handle = handle
+        };
+    #else
+        int file = open(path, O_RDONLY | O_CLOEXEC);
+        if(file < 0) { return QUILL_FALSE; }
+        struct stat info;
+        if(fstat(file, &info) != 0) {
+            close(file);
+            return QUILL_FALSE;
+        }
+        size_t length = (size_t) info.st_size;
+        // pipes and the like can't be mapped and don't know their size
+        if(!S_ISREG(info.st_mode) || length < MIN_MAPPED_LENGTH) {
+            quill_bool_t res = string_from_read(file, length, dest);
+            close(file);
+            return res;
+        }
+        void *address = mmap(NULL, length, PROT_READ, MAP_PRIVATE, file, 0);
+        close(file);
+        if(address == MAP_FAILED) { return QUILL_FALSE; }
+        #ifdef MADV_SEQUENTIAL
+            // validation reads everything from start to end first
+            madvise(address, length, MADV_SEQUENTIAL);
+        #endif
+        quill_string_mapping_t mapping = {
+            .address = address, .length = length
+        };
+    #endif
+    return string_from_mapping(mapping, dest);
+}
+
+
+// The reader holds a reference to the chunk it reads into, as does every
+// line that is longer than an inline string. The bytes of a line that
+// continues past the end of a chunk are moved to the start of the next one.
+
+#define READER_CHUNK_SIZE 65536
+
+static quill_alloc_t *reader_chunk_alloc(size_t capacity) {
+    quill_alloc_t *alloc = quill_malloc(
+        sizeof(quill_string_header_t) + capacity, NULL
+    );
+    // lines are found by their byte offsets, so there is no index
+    quill_string_init_header(
+        alloc, (quill_int_t) capacity, (quill_int_t) capacity
+    );
+    return alloc;
+}
+
+void quill_reader_init(quill_reader_t *reader, int fd) {
+    reader->fd = fd;
+    reader->chunk = NULL;
+    reader->capacity = 0;
+    reader->length = 0;
+    reader->offset = 0;
+    reader->at_end = QUILL_FALSE;
+}
+
+// Makes room for at least one more byte after the unread bytes.
+static void reader_next_chunk(quill_reader_t *reader) {
+    size_t remaining = reader->length - reader->offset;
+    size_t capacity = READER_CHUNK_SIZE;
+    while(capacity <= remaining) { capacity *= 2; }
+    quill_alloc_t *chunk = reader_chunk_alloc(capacity);
+    if(remaining > 0) {
+        memcpy(
+            quill_string_alloc_bytes(chunk),
+            quill_string_alloc_bytes(reader->chunk) + reader->offset,
+            remaining
+        );
+    }
+    if(reader->chunk != NULL) { quill_rc_dec(reader->chunk); }
+    reader->chunk = chunk;
+    reader->capacity = capacity;
+    reader->length = remaining;
+    reader->offset = 0;
+}
+
+static void reader_fill(quill_reader_t *reader) {
+    if(reader->chunk == NULL || reader->length == reader->capacity) {
+        reader_next_chunk(reader);
+    }
+    for(;;) {
+        long long read_c = READ(
+            reader->fd,
+            quill_string_alloc_bytes(reader->chunk) + reader->length,
+            reader->capacity - reader->length
+        );
+        if(read_c < 0) {
+            #ifndef _WIN32
+                if(errno == EINTR) { continue; }
+            #endif
+            quill_panic(quill_string_from_static_cstr(
+                "Unable to read from file\n"
+            ));
+        }
+        if(read_c == 0) { reader->at_end = QUILL_TRUE; }
+        reader->length += (size_t) read_c;
+        return;
+    }
+}
+
+static quill_string_t reader_take_line(
+    quill_reader_t *reader, size_t end, size_t next_offset
+) {
+    const uint8_t *data
+        = quill_string_alloc_bytes(reader->chunk) + reader->offset;
+    size_t length_bytes = end - reader->offset;
+    if(length_bytes > 0 && data[length_bytes - 1] == '\r') {
+        length_bytes -= 1;
+    }
+    reader->offset = next_offset;
+    quill_int_t length_points = quill_utf8_validate(data, length_bytes);
+    if(length_points < 0) {
+        quill_panic(quill_string_from_static_cstr(
+            "String improperly encoded\n"
+        ));
+    }
+    quill_string_t line;
+    line.length_bytes = (quill_int_t) length_bytes;
+    line.length_points = length_points;
+    if(quill_string_is_inline(line)) {
+        memset(line.inline_data, 0, QUILL_STRING_INLINE_MAX);
+        memcpy(line.inline_data, data, length_bytes);
+        return line;
+    }
+    quill_rc_add(reader->chunk);
+    line.alloc = reader->chunk;
+    line.data = data;
+    return line;
+}
+
+quill_bool_t quill_reader_next_line(quill_reader_t *reader, quill_string_t *line) {
+    // bytes before this have already been searched for a line break
+    size_t searched = reader->offset;
+    for(;;) {
+        if(reader->chunk != NULL) {
+            const uint8_t *bytes = quill_string_alloc_bytes(reader->chunk);
+            const uint8_t *found = memchr(
+                bytes + searched, '\n', reader->length - searched
+            );
+            if(found != NULL) {
+                size_t end = (size_t) (found - bytes);
+                *line = reader_take_line(reader, end, end + 1);
+                return QUILL_TRUE;
+            }
+        }
+        if(reader->at_end) {
+            if(reader->offset == reader->length) { return QUILL_FALSE; }
+            // the last line doesn't need to end with a line break
+            *line = reader_take_line(reader, reader->length, reader->length);
+            return QUILL_TRUE;
+        }
+        // moving the unread bytes to a new chunk also moves their offsets
+        size_t unread = reader->length - reader->offset;
+        reader_fill(reader);
+        searched = reader->offset + unread;
+    }
+}
+
+void quill_reader_destroy(quill_reader_t *reader) {
+    if(reader->chunk != NULL) { quill_rc_dec(reader->chunk); }
+    reader->chunk = NULL;
+}
@@ -0,0 +1,106 @@
+#include <quill.h>
+#include <string.h>
+
+// wyhash (final version 4) by Wang Yi, which is both fast on short inputs
+// and passes SMHasher.
+
+static const uint64_t wy_secret[4] = {
+    0xA0761D6478BD642FULL, 0xE7037ED1A0B428DBULL,
+    0x8EBC6AF09C88C6E3ULL, 0x589965CC75374CC3ULL
+};
+
+static void wy_mum(uint64_t *a, uint64_t *b) {
+    #ifdef __SIZEOF_INT128__
+        __uint128_t r = (__uint128_t) *a * *b;
+        *a = (uint64_t) r;
+        *b = (uint64_t) (r >> 64);
+    #else
+        uint64_t a_hi = *a >> 32;
+        uint64_t a_lo = (uint32_t) *a;
+        uint64_t b_hi = *b >> 32;
+        uint64_t b_lo = (uint32_t) *b;
+        uint64_t hi_hi = a_hi * b_hi;
+        uint64_t hi_lo = a_hi * b_lo;
+        uint64_t lo_hi = a_lo * b_hi;
+        uint64_t lo_lo = a_lo * b_lo;
+        uint64_t t = lo_lo + (hi_lo << 32);
+        uint64_t carry = t < lo_lo;
+        uint64_t lo = t + (lo_hi << 32);
+        carry += lo < t;
+        *a = lo;
+        *b = hi_hi + (hi_lo >> 32) + (lo_hi >> 32) + carry;
+    #endif
+}
+
+static uint64_t wy_mix(uint64_t a, uint64_t b) {
+    wy_mum(&a, &b);
+    return a ^ b;
+}
+
+static uint64_t wy_read_8(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(uint64_t));
+    return v;
+}
+
+static uint64_t wy_read_4(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(uint32_t));
+    return v;
+}
+
+static uint64_t wy_read_3(const uint8_t *p, size_t k) {
+    return ((uint64_t) p[0] << 16) | ((uint64_t) p[k >> 1] << 8) | p[k - 1];
+}
+
+uint64_t quill_hash_bytes(const void *data, size_t length, uint64_t seed) {
+    const uint8_t *p = (const uint8_t *) data;
+    seed ^= wy_mix(seed ^ wy_secret[0], wy_secret[1]);
+    uint64_t a;
+    uint64_t b;
+    if(length <= 16) {
+        if(length >= 4) {
+            size_t shift = (length >> 3) << 2;
+            a = (wy_read_4(p) << 32) | wy_read_4(p + shift);
+            b = (wy_read_4(p + length - 4) << 32)
+                | wy_read_4(p + length - 4 - shift);
+        } else if(length > 0) {
+            a = wy_read_3(p, length);
+            b = 0;
+        } else {
+            a = 0;
+            b = 0;
+        }
+    } else {
+        size_t i = length;
+        if(i > 48) {
+            uint64_t see_1 = seed;
+            uint64_t see_2 = seed;
+            do {
+                seed = wy_mix(
+                    wy_read_8(p) ^ wy_secret[1], wy_read_8(p + 8) ^ seed
+                );
+                see_1 = wy_mix(
+                    wy_read_8(p + 16) ^ wy_secret[2], wy_read_8(p + 24) ^ see_1
+                );
+                see_2 = wy_mix(
+                    wy_read_8(p + 32) ^ wy_secret[3], wy_read_8(p + 40) ^ see_2
+                );
+                p += 48;
+                i -= 48;
+            } while(i > 48);
+            seed ^= see_1 ^ see_2;
+        }
+        while(i > 16) {
+            seed = wy_mix(wy_read_8(p) ^ wy_secret[1], wy_read_8(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = wy_read_8(p + i - 16);
+        b = wy_read_8(p + i - 8);
+    }
+    a ^= wy_secret[1];
+    b ^= seed;
+    wy_mum(&a, &b);
+    return wy_mix(a ^ wy_secret[0] ^ length, b ^ wy_secret[1]);
+}
@@ -48,20 +48,80 @@ typedef uint8_t quill_bool_t;
     #include <stdatomic.h>
 #endif
 
+#if __STDC_VERSION__ >= 202311L
+    // C23 - 'thread_local' is built-in
+#elif __STDC_VERSION__ >= 201112L
+    // C11 - 'thread_local' does not exist, but '_Thread_local' is built-in
+    #define thread_local _Thread_local
+#else
+    #error "Thread local storage must be supported"
+#endif
+
 #ifdef _WIN32
     #include <windows.h>
-    typedef CRITICAL_SECTION quill_mutex_t;
 #else
     #include <pthread.h>
-    typedef pthread_mutex_t quill_mutex_t;
 #endif
 
+// Locks spin for a short while before they block. Blocking threads wait
+// on the address of the lock state itself (futexes on Linux). All of them
+// are unlocked / unset when zero-initialized.
+
+typedef struct quill_mutex {
+    // 0 - unlocked, 1 - locked, 2 - locked and possibly waited on
+    _Atomic(uint32_t) state;
+    // only used by recursive mutexes
+    quill_bool_t recursive;
+    uint32_t depth;
+    _Atomic(uintptr_t) owner;
+} quill_mutex_t;
+
 void quill_mutex_init(quill_mutex_t *mutex);
+// Recursive mutexes may be locked again by the thread holding them.
+void quill_mutex_init_recursive(quill_mutex_t *mutex);
 void quill_mutex_lock(quill_mutex_t *mutex);
 quill_bool_t quill_mutex_try_lock(quill_mutex_t *mutex);
 void quill_mutex_unlock(quill_mutex_t *mutex);
 void quill_mutex_destroy(quill_mutex_t *mutex);
 
+// Waiting writers keep new readers from taking the lock.
+// Neither side may lock it again while holding it.
+typedef struct quill_rwlock {
+    _Atomic(uint32_t) state;
+} quill_rwlock_t;
+
+void quill_rwlock_init(quill_rwlock_t *lock);
+void quill_rwlock_read(quill_rwlock_t *lock);
+void quill_rwlock_unlock_read(quill_rwlock_t *lock);
+void quill_rwlock_write(quill_rwlock_t *lock);
+void quill_rwlock_unlock_write(quill_rwlock_t *lock);
+void quill_rwlock_destroy(quill_rwlock_t *lock);
+
+// Waiting requires 'mutex' to be locked by the caller. It is released
+// completely while waiting (recursive ones as well, however often they are
+// held) and locked as before again. Waiting may return without having been
+// signalled.
+typedef struct quill_cond {
+    _Atomic(uint32_t) sequence;
+} quill_cond_t;
+
+void quill_cond_init(quill_cond_t *cond);
+void quill_cond_wait(quill_cond_t *cond, quill_mutex_t *mutex);
+void quill_cond_signal(quill_cond_t *cond);
+void quill_cond_broadcast(quill_cond_t *cond);
+void quill_cond_destroy(quill_cond_t *cond);
+
+// Events are set once and then stay set.
+typedef struct quill_event {
+    // 0 - unset, 1 - set, 2 - unset and possibly waited on
+    _Atomic(uint32_t) state;
+} quill_event_t;
+
+void quill_event_init(quill_event_t *event);
+void quill_event_set(quill_event_t *event);
+quill_bool_t quill_event_is_set(quill_event_t *event);
+void quill_event_wait(quill_event_t *event);
+
 typedef struct quill_alloc quill_alloc_t;
 
 typedef quill_unit_t (*quill_destructor_t)(quill_alloc_t *alloc);
@@ -72,14 +132,81 @@ typedef struct quill_alloc {
     uint8_t data[];
 } quill_alloc_t;
 
+// Traversal hooks let the cycle collector and 'quill_rc_share' enumerate
+// the allocations referenced by an allocation. They are looked up by
+// destructor.
+typedef void (*quill_visit_t)(quill_alloc_t *child, void *context);
+typedef void (*quill_traverse_t)(
+    quill_alloc_t *alloc, quill_visit_t visit, void *context
+);
+
+// Reference count of allocations that are not managed by reference
+// counting, for example because they live in an arena.
+#define QUILL_RC_IMMORTAL ((uint64_t) 1 << 63)
+// Immortal allocations start out with a count that can't be decremented
+// to zero, since without 'QUILL_THREAD_LOCAL_RC' the flag isn't checked.
+#define QUILL_RC_IMMORTAL_NEW (QUILL_RC_IMMORTAL | ((uint64_t) 1 << 56))
+// Set for allocations that may be reachable from more than one thread.
+// The reference count of all other allocations is only ever touched by the
+// thread that allocated them, which means no atomic operations are needed.
+#define QUILL_RC_SHARED ((uint64_t) 1 << 62)
+// Set while the allocation is a candidate root of the cycle collector,
+// which then is responsible for freeing it once the count reaches zero.
+#define QUILL_RC_BUFFERED ((uint64_t) 1 << 61)
+#define QUILL_RC_COLOR_MASK ((uint64_t) 3 << 59)
+// Set for allocations that begin with a 'quill_string_header_t'.
+#define QUILL_RC_STRING_HEADER ((uint64_t) 1 << 58)
+// Set for lists created by 'quill_list_new' with room for inline elements.
+#define QUILL_RC_LIST_INLINE ((uint64_t) 1 << 57)
+#define QUILL_RC_COUNT_MASK (((uint64_t) 1 << 57) - 1)
+
+// Code that calls 'quill_rc_share' on allocations before they become
+// reachable from another thread may define 'QUILL_THREAD_LOCAL_RC', which
+// makes new allocations start out as not shared. Otherwise all of them are
+// shared and counted using plain atomic operations.
+#ifdef QUILL_THREAD_LOCAL_RC
+    #define QUILL_RC_NEW ((uint64_t) 1)
+#else
+    #define QUILL_RC_NEW (1 | QUILL_RC_SHARED)
+#endif
+
+// Code that defines 'QUILL_COLLECT_CYCLES' (and 'QUILL_THREAD_LOCAL_RC')
+// buffers allocations that are not shared as possible cycle roots, which
+// 'quill_rc_collect_cycles' checks.
+
+
+// Strings of up to 'QUILL_STRING_INLINE_MAX' bytes are always stored in
+// place of 'alloc' and 'data', which are only valid for longer strings.
+// Longer strings with a 'data' of NULL are ropes, see 'quill_string_concat'.
+// Use 'quill_string_data' to get the contents of any string.
+#define QUILL_STRING_INLINE_MAX 16
 
 typedef struct quill_string {
-    quill_alloc_t *alloc;
-    const uint8_t *data;
+    union {
+        struct {
+            quill_alloc_t *alloc;
+            const uint8_t *data;
+        };
+        uint8_t inline_data[QUILL_STRING_INLINE_MAX];
+    };
     quill_int_t length_points;
     quill_int_t length_bytes;
 } quill_string_t;
 
+static quill_bool_t quill_string_is_inline(quill_string_t s) {
+    return s.length_bytes <= QUILL_STRING_INLINE_MAX;
+}
+
+const uint8_t *quill_string_flatten(const quill_string_t *s);
+
+// The result points into 's' for short strings,
+// so it is only valid for as long as 's' is.
+static const uint8_t *quill_string_data(const quill_string_t *s) {
+    if(quill_string_is_inline(*s)) { return s->inline_data; }
+    if(s->data == NULL) { return quill_string_flatten(s); }
+    return s->data;
+}
+
 typedef quill_alloc_t *quill_struct_t;
 
 typedef quill_alloc_t *quill_enum_t;
@@ -117,8 +244,43 @@ typedef quill_alloc_t *quill_list_t;
 
 
 void quill_print(quill_string_t text);
+// Prints all parts as if they were one string.
+void quill_print_parts(const quill_string_t *parts, size_t part_c);
 void quill_eprint(quill_string_t text);
 void quill_panic(quill_string_t reason);
+// Writes the output printed by the calling thread that is still buffered.
+void quill_flush(void);
+void quill_flush_destruct_thread(void);
+
+// Large files are mapped into memory instead of being read. The mapping is
+// removed once the string and all slices of it have been freed, and the
+// file must not be truncated while it exists. Pipes and other files that
+// can't be mapped are read into one buffer that grows until the end of the
+// stream, meaning that all of it is held in memory at once; use
+// 'quill_reader_t' to go through long streams line by line instead.
+// Returns QUILL_FALSE if the file can't be read or isn't valid UTF-8.
+quill_bool_t quill_string_from_file(const char *path, quill_string_t *dest);
+
+// Reads lines from a file descriptor (like 0 for stdin) in large chunks.
+// Lines are slices of these chunks, which only get copied when a line
+// continues in the next chunk. The descriptor is only ever read from, so
+// pipes, sockets and terminals work the same as regular files, and at most
+// the chunk holding the current line is kept in memory by the reader.
+typedef struct quill_reader {
+    int fd;
+    quill_alloc_t *chunk;
+    size_t capacity;
+    size_t length;
+    size_t offset;
+    quill_bool_t at_end;
+} quill_reader_t;
+
+void quill_reader_init(quill_reader_t *reader, int fd);
+// Returns QUILL_FALSE once all lines have been read. Lines don't include
+// their line break ("\n" or "\r\n").
+quill_bool_t quill_reader_next_line(quill_reader_t *reader, quill_string_t *line);
+// Does not close the file descriptor.
+void quill_reader_destroy(quill_reader_t *reader);
 
 
 void quill_alloc_init_global(void);
@@ -127,6 +289,105 @@ void *quill_alloc_get_unused(void);
 void quill_alloc_migrate_to(void *to_unused_raw);
 void *quill_alloc_alloc(size_t n);
 void quill_alloc_free(void *alloc);
+void quill_alloc_free_batch(void **allocs, size_t n);
+size_t quill_alloc_trim(void);
+void quill_alloc_set_retention(size_t n, size_t region_c);
+// Returns how many bytes an allocation of 'n' bytes can actually hold.
+size_t quill_alloc_usable_size(size_t n);
+
+#define QUILL_ALLOC_CLASS_COUNT 44
+
+// Counters are only collected by runtimes built with 'QUILL_ALLOC_STATS'.
+// Frees are counted by the thread owning the region the slab is
+// returned to, so per-thread frees may exceed allocations.
+typedef struct quill_alloc_class_stats {
+    size_t slab_size;
+    uint64_t alloc_c;
+    uint64_t free_c;
+} quill_alloc_class_stats_t;
+
+typedef struct quill_alloc_stats {
+    quill_alloc_class_stats_t classes[QUILL_ALLOC_CLASS_COUNT];
+    // slabs freed by other threads
+    uint64_t remote_free_c;
+    // attempts to take a region from the global unused lists,
+    // and how many of them succeeded
+    uint64_t global_fetch_c;
+    uint64_t global_adopt_c;
+    // the remaining counters are only part of 'quill_alloc_stats'
+    uint64_t heap_c;
+    uint64_t region_map_c;
+    uint64_t region_reuse_c;
+    uint64_t region_release_c;
+    // allocations above the largest slab size, mapped individually unless
+    // they can reuse the mapping of a freed one
+    uint64_t large_alloc_c;
+    uint64_t large_free_c;
+    uint64_t large_reuse_c;
+    uint64_t large_size;
+} quill_alloc_stats_t;
+
+quill_alloc_stats_t quill_alloc_stats(void);
+quill_alloc_stats_t quill_alloc_thread_stats(void);
+
+// Sampling heap profiler, only fed by runtimes built with
+// 'QUILL_ALLOC_PROFILE'. On average every 'sample_size' allocated bytes
+// (0 stops sampling) the size and call stack of an allocation are recorded.
+// Dumps are written in the gperftools heap profile format read by pprof.
+void quill_alloc_profile_start(size_t sample_size);
+quill_bool_t quill_alloc_profile_dump(const char *path);
+size_t quill_profile_sample_interval(void);
+void quill_profile_record_alloc(void *alloc, size_t n);
+quill_bool_t quill_profile_record_free(void *alloc);
+
+// Arenas are per-thread - everything allocated after a push is freed
+// by popping the returned mark, so it may not outlive that point.
+typedef struct quill_arena_mark {
+    void *chunk;
+    uint8_t *next;
+    void *destructed;
+} quill_arena_mark_t;
+
+quill_arena_mark_t quill_arena_push(void);
+void quill_arena_pop(quill_arena_mark_t mark);
+void *quill_arena_alloc(size_t n);
+quill_alloc_t *quill_arena_malloc(size_t n, quill_destructor_t destructor);
+
+
+// Lists may keep their first 'inline_capacity' elements inside of the
+// list allocation, after the layout. Their buffer is only allocated
+// separately once they grow past that. Lists that weren't created by this
+// (e.g. a layout allocated with 'quill_malloc') never store them inline.
+quill_list_t quill_list_new(
+    size_t element_size, quill_int_t inline_capacity,
+    quill_destructor_t destructor
+);
+// Frees the buffer of 'list' unless it is stored inline. Lists that may have
+// inline elements must not free their buffer with 'QUILL_LIST_BUFFER_FREE'.
+void quill_list_free_buffer(quill_list_t list);
+void quill_list_reserve(
+    quill_list_t list, size_t element_size, quill_int_t additional
+);
+// The following only move elements around, meaning that the caller
+// is responsible for adding and releasing references held by them.
+// Returns where the new element needs to be written to.
+void *quill_list_push(quill_list_t list, size_t element_size);
+void quill_list_extend(
+    quill_list_t list, size_t element_size,
+    const void *elements, quill_int_t count
+);
+// Moves the elements at and after 'index' back by 'count' and returns
+// where the inserted elements need to be written to.
+void *quill_list_insert(
+    quill_list_t list, size_t element_size, quill_int_t index, quill_int_t count
+);
+void quill_list_remove(
+    quill_list_t list, size_t element_size, quill_int_t index, quill_int_t count
+);
+quill_list_t quill_list_slice(
+    quill_list_t list, size_t element_size, quill_int_t start, quill_int_t end,
+    quill_destructor_t destructor
+);
 
 
 quill_int_t quill_point_encode_length(uint32_t point);
@@ -136,12 +397,205 @@ uint32_t quill_point_decode(const uint8_t *data);
 quill_string_t quill_string_from_points(
     uint32_t *points, quill_int_t length_points
 );
+// Returns the number of code points in 'data',
+// or -1 if it is not valid UTF-8.
+quill_int_t quill_utf8_validate(const uint8_t *data, size_t length_bytes);
+// Returns the number of bytes needed to encode 'points' as UTF-8,
+// or -1 if one of them can't be encoded.
+quill_int_t quill_utf8_length_of_points(
+    const uint32_t *points, size_t length_points
+);
+// 'dest' must hold exactly the 'length_bytes' needed to encode 'points'.
+void quill_utf8_encode(
+    const uint32_t *points, size_t length_points,
+    uint8_t *dest, size_t length_bytes
+);
+// Decodes valid UTF-8 (like the contents of a string) into 'dest', which
+// must have room for all points. Returns the number of points written.
+size_t quill_utf8_decode(
+    const uint8_t *data, size_t length_bytes, uint32_t *dest
+);
 quill_string_t quill_string_from_static_cstr(const char* cstr);
 quill_string_t quill_string_from_temp_cstr(const char *cstr);
+quill_string_t quill_string_from_temp_utf8(
+    const uint8_t *data, quill_int_t length_bytes
+);
+// Skips validation, for contents already known to be valid UTF-8
+// with 'length_points' code points.
+quill_string_t quill_string_from_valid_utf8(
+    const uint8_t *data, quill_int_t length_bytes, quill_int_t length_points
+);
 char *quill_malloc_cstr_from_string(quill_string_t string);
 quill_string_t quill_string_from_int(quill_int_t i);
 quill_string_t quill_string_from_float(quill_float_t f);
 
+// The allocations of strings created by the runtime begin with this header,
+// followed by the bytes of the string. Long strings that aren't ASCII
+// have room for an index of the byte offset of every 64th code point after
+// that, which gets filled in once a code point is first looked up.
+// Strings may also point into allocations made some other way (for example
+// directly by 'quill_malloc'), which then have no header, meaning that
+// nothing is cached for them. Only allocations set up by
+// 'quill_string_init_header' are marked as having one.
+typedef struct quill_string_header {
+    uint64_t length_bytes;
+    // the hash of the contents, or 0 if it hasn't been computed yet
+    _Atomic(uint64_t) hash;
+    uint32_t index_entry_c;
+    _Atomic(uint32_t) index_state;
+} quill_string_header_t;
+
+static quill_bool_t quill_string_has_header(quill_alloc_t *alloc) {
+    uint64_t rc = atomic_load_explicit(&alloc->rc, memory_order_relaxed);
+    return (rc & QUILL_RC_STRING_HEADER) != 0;
+}
+
+static uint8_t *quill_string_alloc_bytes(quill_alloc_t *alloc) {
+    return alloc->data + sizeof(quill_string_header_t);
+}
+
+// Allocations of mapped files hold this instead of the contents.
+typedef struct quill_string_mapping {
+    const uint8_t *address;
+    size_t length;
+    #ifdef _WIN32
+        HANDLE handle;
+    #endif
+} quill_string_mapping_t;
+
+quill_unit_t quill_mapped_string_free(quill_alloc_t *alloc);
+
+static const uint8_t *quill_string_alloc_contents(quill_alloc_t *alloc) {
+    if(alloc->destructor == &quill_mapped_string_free) {
+        return ((quill_string_mapping_t *) quill_string_alloc_bytes(alloc))
+            ->address;
+    }
+    return quill_string_alloc_bytes(alloc);
+}
+
+// Returns the number of bytes needed after the string for the index.
+size_t quill_string_index_size(
+    quill_int_t length_bytes, quill_int_t length_points
+);
+void quill_string_init_header(
+    quill_alloc_t *alloc, quill_int_t length_bytes, quill_int_t length_points
+);
+// Strings are ASCII if and only if both of their lengths are equal, in
+// which case these don't need to look at the contents.
+quill_int_t quill_string_point_offset(
+    const quill_string_t *s, quill_int_t point_i
+);
+uint32_t quill_string_point_at(const quill_string_t *s, quill_int_t point_i);
+
+// Do not take over the reference to 's'. Slices point into the contents of
+// 's' and keep them alive, unless they are short or a small part of a
+// large allocation, in which case they are copied.
+quill_string_t quill_string_slice(
+    quill_string_t s, quill_int_t start_point, quill_int_t end_point
+);
+quill_string_t quill_string_slice_bytes(
+    quill_string_t s, quill_int_t start_byte, quill_int_t end_byte
+);
+// Returns a string with the contents of 's' that doesn't keep any more
+// memory alive than it needs to.
+quill_string_t quill_string_compact(quill_string_t s);
+
+uint64_t quill_hash_bytes(const void *data, size_t length, uint64_t seed);
+// Hashes of strings that aren't slices are cached in their allocation.
+uint64_t quill_string_hash(quill_string_t s);
+// Strings sharing the same contents (like interned strings) are equal
+// without comparing the contents.
+quill_bool_t quill_string_eq(quill_string_t a, quill_string_t b);
+// Returns the canonical string with the contents of 's', which is shared by
+// all threads and never freed. Does not take over the reference to 's'.
+quill_string_t quill_string_intern(quill_string_t s);
+
+// Buffer sizes needed by 'quill_int_format' and 'quill_float_format', which
+// return the number of (ASCII) bytes written. Floats are written using the
+// fewest digits that read back as the same value.
+#define QUILL_INT_FORMAT_MAX 20
+#define QUILL_FLOAT_FORMAT_MAX 32
+quill_int_t quill_int_format(quill_int_t i, uint8_t *dest);
+quill_int_t quill_float_format(quill_float_t f, uint8_t *dest);
+// Return QUILL_FALSE unless all of 'data' is a number that fits the type.
+// Numbers may start with '+' or '-' and have leading zeros. Floats may
+// leave out the digits on one side of the decimal point ("1.", ".5") and
+// have an exponent ("1e-7", "2E+3"). Besides the output of
+// 'quill_float_format' ("nan", "inf" and "-inf" included), this accepts
+// more than the formatter writes. Floats too large for a double are
+// rejected, while tiny ones round to zero.
+quill_bool_t quill_int_parse(
+    const uint8_t *data, size_t length_bytes, quill_int_t *dest
+);
+quill_bool_t quill_float_parse(
+    const uint8_t *data, size_t length_bytes, quill_float_t *dest
+);
+
+// Does not take over the references to 'a' and 'b'. Long results are ropes
+// referencing both sides, which only get copied into one buffer once the
+// contents are needed by 'quill_string_data'. The sides are released after
+// that, except while the rope is referenced from more than one place (with
+// 'QUILL_THREAD_LOCAL_RC': from more than one thread), in which case they
+// are released once it is accessed again with one reference or freed.
+quill_string_t quill_string_concat(quill_string_t a, quill_string_t b);
+quill_unit_t quill_rope_free(quill_alloc_t *alloc);
+void quill_rope_traverse(
+    quill_alloc_t *alloc, quill_visit_t visit, void *context
+);
+// Copies the contents of 's' to 'dest' without flattening ropes.
+void quill_string_copy_to(quill_string_t s, uint8_t *dest);
+
+// Appending to a builder grows its buffer geometrically. Finishing a
+// builder turns the buffer into the string and leaves the builder empty.
+typedef struct quill_string_builder {
+    quill_alloc_t *alloc;
+    size_t length_bytes;
+    size_t capacity;
+    quill_int_t length_points;
+} quill_string_builder_t;
+
+#define QUILL_EMPTY_STRING_BUILDER ((quill_string_builder_t) { .alloc = NULL, .length_bytes = 0, .capacity = 0, .length_points = 0 })
+
+void quill_string_builder_reserve(
+    quill_string_builder_t *builder, size_t additional_bytes
+);
+void quill_string_builder_append(
+    quill_string_builder_t *builder, quill_string_t s
+);
+void quill_string_builder_append_point(
+    quill_string_builder_t *builder, uint32_t point
+);
+void quill_string_builder_append_points(
+    quill_string_builder_t *builder,
+    const uint32_t *points, quill_int_t length_points
+);
+void quill_string_builder_append_int(
+    quill_string_builder_t *builder, quill_int_t i
+);
+void quill_string_builder_append_float(
+    quill_string_builder_t *builder, quill_float_t f
+);
+quill_string_t quill_string_builder_finish(quill_string_builder_t *builder);
+void quill_string_builder_free(quill_string_builder_t *builder);
+
+
+// Runs the destructor of 'alloc' and frees it. Allocations released by a
+// destructor are queued and destroyed iteratively, so freeing deep
+// structures does not use stack space proportional to their depth.
+void quill_rc_destroy(quill_alloc_t *alloc);
+
+// Cycle collection only considers allocations that are not shared and
+// have a destructor. Each call checks at most 'max_root_c' buffered roots
+// and returns the number of allocations freed. A collection of
+// 'slice_root_c' roots is started automatically once 'root_threshold'
+// roots are buffered (never if 0).
+void quill_rc_buffer(quill_alloc_t *alloc);
+void quill_rc_register_traverse(
+    quill_destructor_t destructor, quill_traverse_t traverse
+);
+size_t quill_rc_collect_cycles(size_t max_root_c);
+void quill_rc_set_cycle_collection(size_t root_threshold, size_t slice_root_c);
+void quill_rc_destruct_thread(void);
 
 static quill_alloc_t *quill_malloc(size_t n, quill_destructor_t destructor) {
     if(n == 0) { return NULL; }
@@ -151,13 +605,28 @@ static quill_alloc_t *quill_malloc(size_t n, quill_destructor_t destructor) {
             "Unable to allocate memory\n"
         ));
     }
-    alloc->rc = 1;
+    atomic_store_explicit(&alloc->rc, QUILL_RC_NEW, memory_order_relaxed);
     alloc->destructor = destructor;
     return alloc;
 }
 
+// Must be called by the thread that allocated 'alloc' before it becomes
+// reachable from another thread. Everything reachable from 'alloc' through
+// traversal hooks is marked as well, which means that allocations holding
+// references need a hook, and that allocations stored into shared ones
+// later on need to be shared first.
+void quill_rc_share(quill_alloc_t *alloc);
+
 static void quill_rc_add(quill_alloc_t *alloc) {
     if(alloc == NULL) { return; }
+    #ifdef QUILL_THREAD_LOCAL_RC
+        uint64_t rc = atomic_load_explicit(&alloc->rc, memory_order_relaxed);
+        if((rc & QUILL_RC_IMMORTAL) != 0) { return; }
+        if((rc & QUILL_RC_SHARED) == 0) {
+            atomic_store_explicit(&alloc->rc, rc + 1, memory_order_relaxed);
+            return;
+        }
+    #endif
     atomic_fetch_add_explicit(&alloc->rc, 1, memory_order_relaxed);
 }
 
@@ -165,51 +634,76 @@ static void quill_unit_rc_add(quill_unit_t v) { (void) v; }
 static void quill_int_rc_add(quill_int_t v) { (void) v; }
 static void quill_float_rc_add(quill_float_t v) { (void) v; }
 static void quill_bool_rc_add(quill_bool_t v) { (void) v; }
-static void quill_string_rc_add(quill_string_t v) { quill_rc_add(v.alloc); }
+static void quill_string_rc_add(quill_string_t v) {
+    if(quill_string_is_inline(v)) { return; }
+    quill_rc_add(v.alloc);
+}
 static void quill_closure_rc_add(quill_closure_t v) { quill_rc_add(v.alloc); }
 
 static void quill_rc_dec(quill_alloc_t *alloc) {
     if(alloc == NULL) { return; }
-    // 'atomic_fetch_sub_explicit' returns the value before the subtraction
-    if(atomic_fetch_sub_explicit(&alloc->rc, 1, memory_order_acq_rel) != 1) { 
-        return; 
+    #ifdef QUILL_THREAD_LOCAL_RC
+        uint64_t rc = atomic_load_explicit(&alloc->rc, memory_order_acquire);
+        if((rc & QUILL_RC_IMMORTAL) != 0) { return; }
+        if((rc & QUILL_RC_COUNT_MASK) != 1) {
+            if((rc & QUILL_RC_SHARED) == 0) {
+                atomic_store_explicit(&alloc->rc, rc - 1, memory_order_relaxed);
+                #ifdef QUILL_COLLECT_CYCLES
+                    if((rc & QUILL_RC_BUFFERED) == 0
+                        && alloc->destructor != NULL) {
+                        quill_rc_buffer(alloc);
+                    }
+                #endif
+                return;
+            }
+            // 'atomic_fetch_sub_explicit' returns the value before the
+            // subtraction
+            rc = atomic_fetch_sub_explicit(&alloc->rc, 1, memory_order_acq_rel);
+            if((rc & QUILL_RC_COUNT_MASK) != 1) { return; }
+            atomic_thread_fence(memory_order_acquire);
+        } else if((rc & QUILL_RC_BUFFERED) != 0) {
+            // the cycle collector may clear the flag of shared allocations
+            if((rc & QUILL_RC_SHARED) == 0) {
+                atomic_store_explicit(&alloc->rc, rc - 1, memory_order_relaxed);
+                return;
+            }
+            rc = atomic_fetch_sub_explicit(
+                &alloc->rc, 1, memory_order_acq_rel
+            );
+        }
+        // buffered allocations are freed by the cycle collector
+        if((rc & QUILL_RC_BUFFERED) != 0) { return; }
+        // if we hold the only reference no other thread can add one, meaning
+        // even shared allocations can be freed without an atomic decrement
+    #else
+        // 'atomic_fetch_sub_explicit' returns the value before the subtraction
+        uint64_t rc
+            = atomic_fetch_sub_explicit(&alloc->rc, 1, memory_order_acq_rel);
+        if((rc & QUILL_RC_COUNT_MASK) != 1) { return; }
+        atomic_thread_fence(memory_order_acquire);
+    #endif
+    if(alloc->destructor == NULL) {
+        quill_alloc_free(alloc);
+        return;
     }
-    atomic_thread_fence(memory_order_acquire);
-    quill_destructor_t destructor = alloc->destructor;
-    if(destructor != NULL) { destructor(alloc); }
-    quill_alloc_free(alloc);
+    quill_rc_destroy(alloc);
 }
 
 static void quill_unit_rc_dec(quill_unit_t v) { (void) v; }
 static void quill_int_rc_dec(quill_int_t v) { (void) v; }
 static void quill_float_rc_dec(quill_float_t v) { (void) v; }
 static void quill_bool_rc_dec(quill_bool_t v) { (void) v; }
-static void quill_string_rc_dec(quill_string_t v) { quill_rc_dec(v.alloc); }
-static void quill_closure_rc_dec(quill_closure_t v) { quill_rc_dec(v.alloc); }
-
-
-static quill_unit_t quill_captured_noop_free(quill_alloc_t *alloc) {
-    (void) alloc;
-    return QUILL_UNIT;
-}
-
-static quill_unit_t quill_captured_string_free(quill_alloc_t *alloc) {
-    quill_string_t *ref = (quill_string_t *) alloc->data;
-    quill_rc_dec(ref->alloc);
-    return QUILL_UNIT;
+static void quill_string_rc_dec(quill_string_t v) {
+    if(quill_string_is_inline(v)) { return; }
+    quill_rc_dec(v.alloc);
 }
+static void quill_closure_rc_dec(quill_closure_t v) { quill_rc_dec(v.alloc); }
 
-static quill_unit_t quill_captured_ref_free(quill_alloc_t *alloc) {
-    quill_alloc_t **ref = (quill_alloc_t **) alloc->data;
-    quill_rc_dec(*ref);
-    return QUILL_UNIT;
-}
 
-static quill_unit_t quill_captured_closure_free(quill_alloc_t *alloc) {
-    quill_closure_t *ref = (quill_closure_t *) alloc->data;
-    quill_rc_dec(ref->alloc);
-    return QUILL_UNIT;
-}
+quill_unit_t quill_captured_noop_free(quill_alloc_t *alloc);
+quill_unit_t quill_captured_string_free(quill_alloc_t *alloc);
+quill_unit_t quill_captured_ref_free(quill_alloc_t *alloc);
+quill_unit_t quill_captured_closure_free(quill_alloc_t *alloc);
 
 #define QUILL_UNIT_CAPTURE quill_malloc(sizeof(quill_unit_t), &quill_captured_noop_free)
 #define QUILL_INT_CAPTURE quill_malloc(sizeof(quill_int_t), &quill_captured_noop_free)
@@ -221,6 +715,119 @@ static quill_unit_t quill_captured_closure_free(quill_alloc_t *alloc) {
 #define QUILL_CLOSURE_CAPTURE quill_malloc(sizeof(quill_closure_t), &quill_captured_closure_free)
 #define QUILL_LIST_CAPTURE quill_malloc(sizeof(quill_list_t), &quill_captured_ref_free)
 
+// Environments hold all captured values of a closure in one allocation.
+// Their layout lists the offset and kind of each slot, which is used to
+// release the references in them once the environment is freed.
+#define QUILL_ENV_SLOT_PLAIN 0
+// 'quill_struct_t', 'quill_enum_t', 'quill_list_t' and captures
+#define QUILL_ENV_SLOT_REF 1
+#define QUILL_ENV_SLOT_STRING 2
+#define QUILL_ENV_SLOT_CLOSURE 3
+
+// Releases the reference held by a slot of the given kind.
+static void quill_slot_rc_dec(uint32_t kind, const uint8_t *slot) {
+    if(kind == QUILL_ENV_SLOT_REF) {
+        quill_rc_dec(*((quill_alloc_t * const *) slot));
+    } else if(kind == QUILL_ENV_SLOT_STRING) {
+        quill_string_rc_dec(*((const quill_string_t *) slot));
+    } else if(kind == QUILL_ENV_SLOT_CLOSURE) {
+        quill_rc_dec(((const quill_closure_t *) slot)->alloc);
+    }
+}
+
+static void quill_slot_visit(
+    uint32_t kind, const uint8_t *slot, quill_visit_t visit, void *context
+) {
+    if(kind == QUILL_ENV_SLOT_REF) {
+        visit(*((quill_alloc_t * const *) slot), context);
+    } else if(kind == QUILL_ENV_SLOT_STRING) {
+        const quill_string_t *s = (const quill_string_t *) slot;
+        if(!quill_string_is_inline(*s)) { visit(s->alloc, context); }
+    } else if(kind == QUILL_ENV_SLOT_CLOSURE) {
+        visit(((const quill_closure_t *) slot)->alloc, context);
+    }
+}
+
+typedef struct quill_env_slot {
+    uint32_t kind;
+    uint32_t offset;
+} quill_env_slot_t;
+
+typedef struct quill_env_layout {
+    size_t size;
+    size_t slot_c;
+    const quill_env_slot_t *slots;
+} quill_env_layout_t;
+
+quill_unit_t quill_env_free(quill_alloc_t *alloc);
+
+// The slots need to be written before the environment is used.
+static quill_alloc_t *quill_env_alloc(const quill_env_layout_t *layout) {
+    quill_alloc_t *alloc = quill_malloc(
+        sizeof(const quill_env_layout_t *) + layout->size, &quill_env_free
+    );
+    *((const quill_env_layout_t **) alloc->data) = layout;
+    return alloc;
+}
+
+static uint8_t *quill_env_slots(quill_alloc_t *env) {
+    return env->data + sizeof(const quill_env_layout_t *);
+}
+
+
+// Hash maps with open addressing, storing a control byte for each entry
+// (whether it is empty, deleted or holds a key with the given 7 lower bits
+// of the hash) that are compared in groups of 16 at once. Keys and values
+// are stored next to each other in the same buffer as the control bytes.
+// The kinds of keys and values are the kinds of environment slots.
+typedef uint64_t (*quill_map_hash_t)(const void *key);
+typedef quill_bool_t (*quill_map_eq_t)(const void *a, const void *b);
+
+typedef struct quill_map_type {
+    size_t key_size;
+    size_t value_size;
+    uint32_t key_kind;
+    uint32_t value_kind;
+    quill_map_hash_t hash;
+    quill_map_eq_t eq;
+} quill_map_type_t;
+
+uint64_t quill_map_hash_int(const void *key);
+quill_bool_t quill_map_eq_int(const void *a, const void *b);
+uint64_t quill_map_hash_string(const void *key);
+quill_bool_t quill_map_eq_string(const void *a, const void *b);
+
+typedef struct quill_map {
+    const quill_map_type_t *type;
+    void *buffer;
+    uint8_t *control;
+    uint8_t *entries;
+    size_t capacity;
+    size_t length;
+    // number of insertions into empty entries until the map needs to grow
+    size_t growth_left;
+} quill_map_t;
+
+void quill_map_init(quill_map_t *map, const quill_map_type_t *type);
+// Releases all keys and values.
+void quill_map_destroy(quill_map_t *map);
+void quill_map_reserve(quill_map_t *map, size_t additional);
+// Returns where the value of 'key' is stored, or NULL if there is none.
+void *quill_map_get(const quill_map_t *map, const void *key);
+// Takes over the references to 'key' and 'value'. If there already is a
+// value for 'key' it is released, as is the new 'key'.
+void quill_map_set(quill_map_t *map, const void *key, const void *value);
+// Releases the key and value. Returns QUILL_FALSE if 'key' isn't present.
+quill_bool_t quill_map_remove(quill_map_t *map, const void *key);
+// Iterates over all entries in no particular order, starting with '*i'
+// set to 0. The map may not be changed while iterating.
+quill_bool_t quill_map_next(
+    const quill_map_t *map, size_t *i, void **key, void **value
+);
+void quill_map_traverse(
+    const quill_map_t *map, quill_visit_t visit, void *context
+);
+
 #define QUILL_CLOSURE_FPTR(closure, ret_type, ...) \
     ((ret_type (*)(quill_alloc_t *, __VA_ARGS__)) (closure).body)
 
@@ -244,4 +851,18 @@ void quill_runtime_destruct_dyn(void *unused_allocs);
 void quill_runtime_init_thread(void);
 void quill_runtime_destruct_thread(void);
 
+// Tasks are closures without arguments that run on a pool of worker
+// threads, which take tasks from each other once they run out of their
+// own. The pool is started by the first spawned task, with one worker per
+// core unless 'quill_sched_init' was called before.
+typedef struct quill_task quill_task_t;
+
+void quill_sched_init(size_t worker_c);
+// Takes over the reference to 'closure', which is shared together with
+// everything it references (see 'quill_rc_share').
+quill_task_t *quill_task_spawn(quill_closure_t closure);
+// Runs other tasks while waiting and blocks once there are none left.
+// Every task must be joined exactly once.
+void quill_task_join(quill_task_t *task);
+
 #endif
\ No newline at end of file
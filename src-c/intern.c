@@ -0,0 +1,205 @@
+#include <quill.h>
+#include <string.h>
+
+#define STRING_HASH_SEED 0x9E3779B97F4A7C15ULL
+
+// Returns the header of the allocation of 's' if 's' is all of it,
+// meaning that the header describes exactly the contents of 's'.
+static quill_string_header_t *whole_header(const quill_string_t *s) {
+    if(quill_string_is_inline(*s) || s->alloc == NULL || s->data == NULL
+        || !quill_string_has_header(s->alloc)) {
+        return NULL;
+    }
+    quill_string_header_t *header = (quill_string_header_t *) s->alloc->data;
+    if(s->data != quill_string_alloc_contents(s->alloc)) { return NULL; }
+    if(header->length_bytes != (uint64_t) s->length_bytes) { return NULL; }
+    return header;
+}
+
+uint64_t quill_string_hash(quill_string_t s) {
+    quill_string_header_t *header = whole_header(&s);
+    if(header != NULL) {
+        uint64_t hash = atomic_load_explicit(&header->hash, memory_order_relaxed);
+        if(hash != 0) { return hash; }
+    }
+    uint64_t hash = quill_hash_bytes(
+        quill_string_data(&s), (size_t) s.length_bytes, STRING_HASH_SEED
+    );
+    if(header != NULL) {
+        atomic_store_explicit(&header->hash, hash, memory_order_relaxed);
+    }
+    return hash;
+}
+
+quill_bool_t quill_string_eq(quill_string_t a, quill_string_t b) {
+    if(a.length_bytes != b.length_bytes) { return QUILL_FALSE; }
+    if(a.length_points != b.length_points) { return QUILL_FALSE; }
+    // the unused bytes of inline strings are always zero
+    if(quill_string_is_inline(a)) {
+        return memcmp(
+            a.inline_data, b.inline_data, QUILL_STRING_INLINE_MAX
+        ) == 0;
+    }
+    if(a.data == b.data && a.data != NULL) { return QUILL_TRUE; }
+    quill_string_header_t *a_header = whole_header(&a);
+    quill_string_header_t *b_header = whole_header(&b);
+    if(a_header != NULL && b_header != NULL) {
+        uint64_t a_hash
+            = atomic_load_explicit(&a_header->hash, memory_order_relaxed);
+        uint64_t b_hash
+            = atomic_load_explicit(&b_header->hash, memory_order_relaxed);
+        if(a_hash != 0 && b_hash != 0 && a_hash != b_hash) {
+            return QUILL_FALSE;
+        }
+    }
+    return memcmp(
+        quill_string_data(&a), quill_string_data(&b), (size_t) a.length_bytes
+    ) == 0;
+}
+
+
+// Interned strings live in immortal allocations found through a table that
+// is split into shards by the upper bits of the hash, each with its own
+// lock and open addressing. Nothing is allocated while holding the lock.
+
+#define SHARD_C 64
+#define SHARD_BITS 6
+#define MIN_SHARD_CAPACITY 64
+
+typedef struct quill_intern_shard {
+    quill_mutex_t lock;
+    quill_alloc_t **slots;
+    size_t capacity;
+    size_t count;
+} quill_intern_shard_t;
+
+static quill_intern_shard_t shards[SHARD_C];
+
+static uint64_t interned_hash(quill_alloc_t *alloc) {
+    quill_string_header_t *header = (quill_string_header_t *) alloc->data;
+    return atomic_load_explicit(&header->hash, memory_order_relaxed);
+}
+
+static size_t grown_capacity(const quill_intern_shard_t *shard) {
+    return shard->capacity == 0 ? MIN_SHARD_CAPACITY : shard->capacity * 2;
+}
+
+static quill_alloc_t **alloc_slots(size_t capacity) {
+    quill_alloc_t **slots = calloc(capacity, sizeof(quill_alloc_t *));
+    if(slots == NULL) {
+        quill_panic(quill_string_from_static_cstr(
+            "Unable to allocate memory\n"
+        ));
+    }
+    return slots;
+}
+
+// Moves the entries of 'shard' into 'slots', which has room for
+// 'capacity' of them, and returns the previous ones.
+static quill_alloc_t **grow_shard(
+    quill_intern_shard_t *shard, quill_alloc_t **slots, size_t capacity
+) {
+    for(size_t i = 0; i < shard->capacity; i += 1) {
+        quill_alloc_t *alloc = shard->slots[i];
+        if(alloc == NULL) { continue; }
+        size_t slot = (size_t) interned_hash(alloc) & (capacity - 1);
+        while(slots[slot] != NULL) { slot = (slot + 1) & (capacity - 1); }
+        slots[slot] = alloc;
+    }
+    quill_alloc_t **previous = shard->slots;
+    shard->slots = slots;
+    shard->capacity = capacity;
+    return previous;
+}
+
+static quill_alloc_t *make_interned(const quill_string_t *s, uint64_t hash) {
+    quill_alloc_t *alloc = quill_malloc(
+        sizeof(quill_string_header_t) + sizeof(uint8_t) * s->length_bytes
+            + quill_string_index_size(s->length_bytes, s->length_points),
+        NULL
+    );
+    atomic_store_explicit(
+        &alloc->rc, QUILL_RC_IMMORTAL_NEW, memory_order_relaxed
+    );
+    quill_string_init_header(alloc, s->length_bytes, s->length_points);
+    quill_string_header_t *header = (quill_string_header_t *) alloc->data;
+    atomic_store_explicit(&header->hash, hash, memory_order_relaxed);
+    quill_string_copy_to(*s, quill_string_alloc_bytes(alloc));
+    return alloc;
+}
+
+// Returns the slot that either holds the interned version of 's'
+// or where it needs to be inserted.
+static size_t find_interned(
+    const quill_intern_shard_t *shard, const quill_string_t *s,
+    const uint8_t *data, uint64_t hash
+) {
+    size_t slot = (size_t) hash & (shard->capacity - 1);
+    for(;;) {
+        quill_alloc_t *alloc = shard->slots[slot];
+        if(alloc == NULL) { return slot; }
+        quill_string_header_t *header = (quill_string_header_t *) alloc->data;
+        quill_bool_t found = interned_hash(alloc) == hash
+            && header->length_bytes == (uint64_t) s->length_bytes
+            && memcmp(
+                quill_string_alloc_bytes(alloc), data,
+                (size_t) s->length_bytes
+            ) == 0;
+        if(found) { return slot; }
+        slot = (slot + 1) & (shard->capacity - 1);
+    }
+}
+
+quill_string_t quill_string_intern(quill_string_t s) {
+    // already canonical, since they are compared by value
+    if(quill_string_is_inline(s)) { return s; }
+    uint64_t hash = quill_string_hash(s);
+    const uint8_t *data = quill_string_data(&s);
+    quill_intern_shard_t *shard = &shards[hash >> (64 - SHARD_BITS)];
+    // the new entry and the grown table are allocated with the lock
+    // released, after which the shard needs to be looked at again
+    quill_alloc_t *created = NULL;
+    quill_alloc_t **slots = NULL;
+    size_t capacity = 0;
+    quill_alloc_t *alloc;
+    quill_mutex_lock(&shard->lock);
+    for(;;) {
+        if((shard->count + 1) * 2 > shard->capacity) {
+            if(capacity != grown_capacity(shard)) {
+                capacity = grown_capacity(shard);
+                quill_mutex_unlock(&shard->lock);
+                free(slots);
+                slots = alloc_slots(capacity);
+                quill_mutex_lock(&shard->lock);
+                continue;
+            }
+            // the previous slots are freed once the lock is released
+            slots = grow_shard(shard, slots, capacity);
+            capacity = 0;
+        }
+        size_t slot = find_interned(shard, &s, data, hash);
+        alloc = shard->slots[slot];
+        if(alloc != NULL) { break; }
+        if(created == NULL) {
+            quill_mutex_unlock(&shard->lock);
+            created = make_interned(&s, hash);
+            quill_mutex_lock(&shard->lock);
+            continue;
+        }
+        alloc = created;
+        created = NULL;
+        shard->slots[slot] = alloc;
+        shard->count += 1;
+        break;
+    }
+    quill_mutex_unlock(&shard->lock);
+    // another thread interned the same contents in the meantime
+    if(created != NULL) { quill_alloc_free(created); }
+    free(slots);
+    quill_string_t res;
+    res.alloc = alloc;
+    res.data = quill_string_alloc_bytes(alloc);
+    res.length_bytes = s.length_bytes;
+    res.length_points = s.length_points;
+    return res;
+}
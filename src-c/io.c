@@ -1,19 +1,234 @@
-
 #include <quill.h>
 #include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+    #include <io.h>
+    #define STDOUT_FD 1
+    #define STDERR_FD 2
+    #define IS_TTY(fd) _isatty(fd)
+#else
+    #include <unistd.h>
+    #include <errno.h>
+    #include <sys/uio.h>
+    #define STDOUT_FD STDOUT_FILENO
+    #define STDERR_FD STDERR_FILENO
+    #define IS_TTY(fd) isatty(fd)
+#endif
+
+// Output to stdout is collected in a buffer per thread, which gets written
+// once it is full, after every line if stdout is a terminal, when calling
+// 'quill_flush', when the thread is destructed and when the process exits.
+// Output to stderr is written right away. The buffers of all threads are
+// kept in a list so that they can be written on exit, for which each of
+// them is locked by its thread while in use.
+
+#define OUTPUT_BUFFER_SIZE 65536
+// number of parts written by one call to 'writev'
+#define MAX_WRITE_PARTS 16
+
+typedef struct quill_output_buffer {
+    // recursive, since panicking while printing flushes the buffer
+    quill_mutex_t lock;
+    uint8_t *data;
+    size_t length;
+    struct quill_output_buffer *prev;
+    struct quill_output_buffer *next;
+} quill_output_buffer_t;
+
+static thread_local quill_output_buffer_t *stdout_buffer = NULL;
+static quill_mutex_t buffers_lock;
+static quill_output_buffer_t *buffers = NULL;
+
+#define TTY_UNKNOWN -1
+static _Atomic(int) stdout_is_tty = TTY_UNKNOWN;
+static atomic_flag exit_flush_registered = ATOMIC_FLAG_INIT;
+
+static quill_bool_t is_line_buffered(void) {
+    int is_tty = atomic_load_explicit(&stdout_is_tty, memory_order_relaxed);
+    if(is_tty == TTY_UNKNOWN) {
+        is_tty = IS_TTY(STDOUT_FD) ? 1 : 0;
+        atomic_store_explicit(&stdout_is_tty, is_tty, memory_order_relaxed);
+    }
+    return is_tty == 1;
+}
+
+typedef struct quill_output_part {
+    const uint8_t *data;
+    size_t length;
+} quill_output_part_t;
+
+// Writes all parts in order, retrying after partial writes.
+static void write_parts(int fd, quill_output_part_t *parts, size_t part_c) {
+    #ifdef _WIN32
+        FILE *f = fd == STDERR_FD ? stderr : stdout;
+        for(size_t i = 0; i < part_c; i += 1) {
+            fwrite(parts[i].data, sizeof(uint8_t), parts[i].length, f);
+        }
+        fflush(f);
+    #else
+        struct iovec iov[MAX_WRITE_PARTS];
+        size_t part_i = 0;
+        size_t offset = 0;
+        while(part_i < part_c) {
+            size_t iov_c = 0;
+            for(size_t i = part_i; i < part_c && iov_c < MAX_WRITE_PARTS; i += 1) {
+                size_t skipped = i == part_i ? offset : 0;
+                iov[iov_c].iov_base = (void *) (parts[i].data + skipped);
+                iov[iov_c].iov_len = parts[i].length - skipped;
+                iov_c += 1;
+            }
+            ssize_t written = writev(fd, iov, (int) iov_c);
+            if(written < 0) {
+                if(errno == EINTR) { continue; }
+                // nothing sensible can be done if the output is gone
+                return;
+            }
+            size_t remaining = (size_t) written;
+            while(part_i < part_c
+                && remaining >= parts[part_i].length - offset) {
+                remaining -= parts[part_i].length - offset;
+                part_i += 1;
+                offset = 0;
+            }
+            offset += remaining;
+        }
+    #endif
+}
+
+// Must be called with the lock of 'buffer' held.
+static void flush_buffer(quill_output_buffer_t *buffer) {
+    if(buffer->length == 0) { return; }
+    quill_output_part_t part = {
+        .data = buffer->data, .length = buffer->length
+    };
+    buffer->length = 0;
+    write_parts(STDOUT_FD, &part, 1);
+}
+
+static void flush_at_exit(void) {
+    quill_mutex_lock(&buffers_lock);
+    for(quill_output_buffer_t *buffer = buffers; buffer != NULL;
+        buffer = buffer->next) {
+        quill_mutex_lock(&buffer->lock);
+        flush_buffer(buffer);
+        quill_mutex_unlock(&buffer->lock);
+    }
+    quill_mutex_unlock(&buffers_lock);
+}
+
+static quill_output_buffer_t *get_stdout_buffer(void) {
+    if(stdout_buffer != NULL) { return stdout_buffer; }
+    if(!atomic_flag_test_and_set_explicit(
+        &exit_flush_registered, memory_order_relaxed
+    )) {
+        atexit(&flush_at_exit);
+    }
+    quill_output_buffer_t *buffer
+        = malloc(sizeof(quill_output_buffer_t) + OUTPUT_BUFFER_SIZE);
+    if(buffer == NULL) {
+        quill_panic(quill_string_from_static_cstr(
+            "Unable to allocate memory\n"
+        ));
+    }
+    quill_mutex_init_recursive(&buffer->lock);
+    buffer->data = (uint8_t *) (buffer + 1);
+    buffer->length = 0;
+    buffer->prev = NULL;
+    quill_mutex_lock(&buffers_lock);
+    buffer->next = buffers;
+    if(buffers != NULL) { buffers->prev = buffer; }
+    buffers = buffer;
+    quill_mutex_unlock(&buffers_lock);
+    stdout_buffer = buffer;
+    return buffer;
+}
+
+void quill_flush(void) {
+    quill_output_buffer_t *buffer = stdout_buffer;
+    if(buffer == NULL) { return; }
+    quill_mutex_lock(&buffer->lock);
+    flush_buffer(buffer);
+    quill_mutex_unlock(&buffer->lock);
+}
+
+void quill_flush_destruct_thread(void) {
+    quill_output_buffer_t *buffer = stdout_buffer;
+    if(buffer == NULL) { return; }
+    quill_mutex_lock(&buffers_lock);
+    if(buffer->prev != NULL) { buffer->prev->next = buffer->next; }
+    else { buffers = buffer->next; }
+    if(buffer->next != NULL) { buffer->next->prev = buffer->prev; }
+    quill_mutex_unlock(&buffers_lock);
+    // no other thread can see the buffer anymore
+    flush_buffer(buffer);
+    quill_mutex_destroy(&buffer->lock);
+    free(buffer);
+    stdout_buffer = NULL;
+}
+
+void quill_print_parts(const quill_string_t *parts, size_t part_c) {
+    quill_output_buffer_t *buffer = get_stdout_buffer();
+    size_t length = 0;
+    for(size_t i = 0; i < part_c; i += 1) {
+        length += (size_t) parts[i].length_bytes;
+    }
+    quill_mutex_lock(&buffer->lock);
+    if(buffer->length + length <= OUTPUT_BUFFER_SIZE) {
+        // ropes are copied piece by piece, so newlines are looked for
+        // in the copy instead of flattening them
+        uint8_t *start = buffer->data + buffer->length;
+        for(size_t i = 0; i < part_c; i += 1) {
+            quill_string_copy_to(parts[i], buffer->data + buffer->length);
+            buffer->length += (size_t) parts[i].length_bytes;
+        }
+        if(buffer->length == OUTPUT_BUFFER_SIZE
+            || (is_line_buffered() && memchr(start, '\n', length) != NULL)) {
+            flush_buffer(buffer);
+        }
+        quill_mutex_unlock(&buffer->lock);
+        return;
+    }
+    // too large to be buffered, so everything is written at once
+    quill_output_part_t written[MAX_WRITE_PARTS];
+    size_t written_c = 0;
+    if(buffer->length > 0) {
+        written[0].data = buffer->data;
+        written[0].length = buffer->length;
+        written_c = 1;
+        buffer->length = 0;
+    }
+    for(size_t i = 0; i < part_c; i += 1) {
+        if(written_c == MAX_WRITE_PARTS) {
+            write_parts(STDOUT_FD, written, written_c);
+            written_c = 0;
+        }
+        written[written_c].data = quill_string_data(&parts[i]);
+        written[written_c].length = (size_t) parts[i].length_bytes;
+        written_c += 1;
+    }
+    write_parts(STDOUT_FD, written, written_c);
+    quill_mutex_unlock(&buffer->lock);
+}
 
 void quill_print(quill_string_t text) {
-    fwrite(text.data, sizeof(uint8_t), text.length_bytes, stdout);
-    fflush(stdout);
+    quill_print_parts(&text, 1);
+}
+
+static void write_stderr(quill_string_t text) {
+    // keeps the order of output of this thread if both go to the same place
+    quill_flush();
+    quill_output_part_t part = {
+        .data = quill_string_data(&text), .length = (size_t) text.length_bytes
+    };
+    write_parts(STDERR_FD, &part, 1);
 }
 
 void quill_eprint(quill_string_t text) {
-    fwrite(text.data, sizeof(uint8_t), text.length_bytes, stderr);
-    fflush(stdout);
+    write_stderr(text);
 }
 
 void quill_panic(quill_string_t reason) {
-    fwrite(reason.data, sizeof(uint8_t), reason.length_bytes, stderr);
-    fflush(stdout);
+    write_stderr(reason);
     exit(1);
-}
\ No newline at end of file
+}
@@ -0,0 +1,186 @@
+#include <quill.h>
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#define MIN_LIST_CAPACITY 4
+
+static quill_list_layout_t *list_layout(quill_list_t list) {
+    return (quill_list_layout_t *) list->data;
+}
+
+static uint8_t *list_inline_buffer(quill_list_t list) {
+    return list->data + sizeof(quill_list_layout_t);
+}
+
+// The address right after the layout may as well be the start of a
+// separately allocated buffer if the list has no room for inline elements,
+// which is why these are marked when created.
+static quill_bool_t list_buffer_is_inline(quill_list_t list) {
+    uint64_t rc = atomic_load_explicit(&list->rc, memory_order_relaxed);
+    return (rc & QUILL_RC_LIST_INLINE) != 0
+        && list_layout(list)->buffer == list_inline_buffer(list);
+}
+
+static uint8_t *list_element(
+    quill_list_layout_t *layout, size_t element_size, quill_int_t index
+) {
+    return (uint8_t *) layout->buffer + element_size * (size_t) index;
+}
+
+quill_list_t quill_list_new(
+    size_t element_size, quill_int_t inline_capacity,
+    quill_destructor_t destructor
+) {
+    size_t size = sizeof(quill_list_layout_t)
+        + element_size * (size_t) inline_capacity;
+    if(inline_capacity > 0) {
+        // fills the rest of the size class with inline elements
+        size = quill_alloc_usable_size(sizeof(quill_alloc_t) + size)
+            - sizeof(quill_alloc_t);
+        inline_capacity = (quill_int_t) (
+            (size - sizeof(quill_list_layout_t)) / element_size
+        );
+    }
+    quill_list_t list = quill_malloc(size, destructor);
+    if(inline_capacity > 0) {
+        uint64_t rc = atomic_load_explicit(&list->rc, memory_order_relaxed);
+        atomic_store_explicit(
+            &list->rc, rc | QUILL_RC_LIST_INLINE, memory_order_relaxed
+        );
+    }
+    quill_list_layout_t *layout = list_layout(list);
+    layout->buffer = inline_capacity == 0 ? NULL : list_inline_buffer(list);
+    layout->capacity = inline_capacity;
+    layout->length = 0;
+    return list;
+}
+
+void quill_list_free_buffer(quill_list_t list) {
+    quill_list_layout_t *layout = list_layout(list);
+    if(layout->buffer == NULL) { return; }
+    if(list_buffer_is_inline(list)) { return; }
+    QUILL_LIST_BUFFER_FREE(layout->buffer);
+}
+
+void quill_list_reserve(
+    quill_list_t list, size_t element_size, quill_int_t additional
+) {
+    quill_list_layout_t *layout = list_layout(list);
+    // inline buffers must only be freed through 'quill_list_free_buffer',
+    // after which the list may not be used anymore
+    assert(layout->length >= 0 && layout->length <= layout->capacity);
+    assert((layout->buffer == NULL) == (layout->capacity == 0));
+    assert(additional >= 0);
+    if(additional <= layout->capacity - layout->length) { return; }
+    // larger sizes can't be allocated, and keep the capacity in range
+    size_t max_capacity = PTRDIFF_MAX / element_size;
+    size_t length = (size_t) layout->length;
+    if((size_t) additional > max_capacity - length) {
+        quill_panic(quill_string_from_static_cstr(
+            "Unable to allocate memory\n"
+        ));
+    }
+    size_t required = length + (size_t) additional;
+    size_t capacity = (size_t) layout->capacity;
+    if(capacity > max_capacity - capacity / 2) {
+        capacity = max_capacity;
+    } else {
+        capacity += capacity / 2;
+    }
+    if(capacity < MIN_LIST_CAPACITY) { capacity = MIN_LIST_CAPACITY; }
+    if(capacity < required) { capacity = required; }
+    // whatever the allocator rounds the size up to can be used as well
+    size_t size = quill_alloc_usable_size(element_size * capacity);
+    void *buffer = QUILL_LIST_BUFFER_ALLOC(size);
+    if(buffer == NULL) {
+        quill_panic(quill_string_from_static_cstr(
+            "Unable to allocate memory\n"
+        ));
+    }
+    if(layout->length > 0) {
+        memcpy(buffer, layout->buffer, element_size * (size_t) layout->length);
+    }
+    quill_list_free_buffer(list);
+    layout->buffer = buffer;
+    layout->capacity = (quill_int_t) (size / element_size);
+}
+
+void *quill_list_push(quill_list_t list, size_t element_size) {
+    quill_list_layout_t *layout = list_layout(list);
+    if(layout->length == layout->capacity) {
+        quill_list_reserve(list, element_size, 1);
+    }
+    uint8_t *dest = list_element(layout, element_size, layout->length);
+    layout->length += 1;
+    return dest;
+}
+
+void quill_list_extend(
+    quill_list_t list, size_t element_size,
+    const void *elements, quill_int_t count
+) {
+    if(count == 0) { return; }
+    quill_list_reserve(list, element_size, count);
+    quill_list_layout_t *layout = list_layout(list);
+    memcpy(
+        list_element(layout, element_size, layout->length), elements,
+        element_size * (size_t) count
+    );
+    layout->length += count;
+}
+
+static void check_list_bounds(
+    quill_int_t start, quill_int_t end, quill_int_t length
+) {
+    if(start < 0 || end < start || end > length) {
+        quill_panic(quill_string_from_static_cstr(
+            "List index out of bounds\n"
+        ));
+    }
+}
+
+void *quill_list_insert(
+    quill_list_t list, size_t element_size, quill_int_t index, quill_int_t count
+) {
+    quill_list_layout_t *layout = list_layout(list);
+    check_list_bounds(index, index, layout->length);
+    if(count == 0) { return list_element(layout, element_size, index); }
+    quill_list_reserve(list, element_size, count);
+    uint8_t *at = list_element(layout, element_size, index);
+    memmove(
+        at + element_size * (size_t) count, at,
+        element_size * (size_t) (layout->length - index)
+    );
+    layout->length += count;
+    return at;
+}
+
+void quill_list_remove(
+    quill_list_t list, size_t element_size, quill_int_t index, quill_int_t count
+) {
+    quill_list_layout_t *layout = list_layout(list);
+    check_list_bounds(index, index + count, layout->length);
+    if(count == 0) { return; }
+    uint8_t *at = list_element(layout, element_size, index);
+    memmove(
+        at, at + element_size * (size_t) count,
+        element_size * (size_t) (layout->length - index - count)
+    );
+    layout->length -= count;
+}
+
+quill_list_t quill_list_slice(
+    quill_list_t list, size_t element_size, quill_int_t start, quill_int_t end,
+    quill_destructor_t destructor
+) {
+    quill_list_layout_t *layout = list_layout(list);
+    check_list_bounds(start, end, layout->length);
+    // the elements are stored inline, so the copy only needs one allocation
+    quill_list_t res = quill_list_new(element_size, end - start, destructor);
+    quill_list_extend(
+        res, element_size, list_element(layout, element_size, start),
+        end - start
+    );
+    return res;
+}
@@ -0,0 +1,355 @@
+#include <quill.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) \
+    || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define HAS_SSE2_GROUPS
+    #include <emmintrin.h>
+#endif
+
+#define GROUP_SIZE 16
+
+#define CONTROL_EMPTY ((uint8_t) 0x80)
+#define CONTROL_DELETED ((uint8_t) 0xFE)
+// full entries hold the lower 7 bits of the hash, meaning the upper bit
+// is only set for empty and deleted entries
+
+// up to 7/8 of the entries may be full (or deleted)
+#define MAX_LOAD_NUM 7
+#define MAX_LOAD_DEN 8
+
+typedef uint32_t quill_group_mask_t;
+
+#ifdef HAS_SSE2_GROUPS
+    static quill_group_mask_t group_match(const uint8_t *group, uint8_t b) {
+        __m128i g = _mm_loadu_si128((const __m128i *) group);
+        __m128i m = _mm_cmpeq_epi8(g, _mm_set1_epi8((char) b));
+        return (quill_group_mask_t) _mm_movemask_epi8(m);
+    }
+
+    static quill_group_mask_t group_match_empty(const uint8_t *group) {
+        return group_match(group, CONTROL_EMPTY);
+    }
+
+    static quill_group_mask_t group_match_free(const uint8_t *group) {
+        __m128i g = _mm_loadu_si128((const __m128i *) group);
+        return (quill_group_mask_t) _mm_movemask_epi8(g);
+    }
+#else
+    static quill_group_mask_t group_match(const uint8_t *group, uint8_t b) {
+        quill_group_mask_t mask = 0;
+        for(size_t i = 0; i < GROUP_SIZE; i += 1) {
+            mask |= (quill_group_mask_t) (group[i] == b) << i;
+        }
+        return mask;
+    }
+
+    static quill_group_mask_t group_match_empty(const uint8_t *group) {
+        return group_match(group, CONTROL_EMPTY);
+    }
+
+    static quill_group_mask_t group_match_free(const uint8_t *group) {
+        quill_group_mask_t mask = 0;
+        for(size_t i = 0; i < GROUP_SIZE; i += 1) {
+            mask |= (quill_group_mask_t) (group[i] >> 7) << i;
+        }
+        return mask;
+    }
+#endif
+
+static size_t lowest_bit_i(quill_group_mask_t mask) {
+    #if defined(__GNUC__) || defined(__clang__)
+        return (size_t) __builtin_ctz(mask);
+    #else
+        size_t i = 0;
+        while((mask & 1) == 0) {
+            mask >>= 1;
+            i += 1;
+        }
+        return i;
+    #endif
+}
+
+static size_t highest_bit_i(quill_group_mask_t mask) {
+    #if defined(__GNUC__) || defined(__clang__)
+        return (size_t) (31 - __builtin_clz(mask));
+    #else
+        size_t i = 0;
+        while(mask >>= 1) { i += 1; }
+        return i;
+    #endif
+}
+
+static uint64_t hash_mix(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xFF51AFD7ED558CCDULL;
+    x ^= x >> 33;
+    x *= 0xC4CEB9FE1A85EC53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+uint64_t quill_map_hash_int(const void *key) {
+    return hash_mix((uint64_t) *((const quill_int_t *) key));
+}
+
+quill_bool_t quill_map_eq_int(const void *a, const void *b) {
+    return *((const quill_int_t *) a) == *((const quill_int_t *) b);
+}
+
+uint64_t quill_map_hash_string(const void *key) {
+    return quill_string_hash(*((const quill_string_t *) key));
+}
+
+quill_bool_t quill_map_eq_string(const void *a, const void *b) {
+    return quill_string_eq(
+        *((const quill_string_t *) a), *((const quill_string_t *) b)
+    );
+}
+
+static size_t entry_size(const quill_map_type_t *type) {
+    size_t key_size = (type->key_size + 7) & ~(size_t) 7;
+    size_t size = key_size + type->value_size;
+    return (size + 7) & ~(size_t) 7;
+}
+
+static size_t value_offset(const quill_map_type_t *type) {
+    return (type->key_size + 7) & ~(size_t) 7;
+}
+
+static uint8_t *entry_at(const quill_map_t *map, size_t i) {
+    return map->entries + i * entry_size(map->type);
+}
+
+// The control bytes of the first group are repeated after the last one,
+// so that a group can be loaded starting at any entry.
+static void set_control(quill_map_t *map, size_t i, uint8_t control) {
+    map->control[i] = control;
+    if(i < GROUP_SIZE) { map->control[map->capacity + i] = control; }
+}
+
+static size_t max_load(size_t capacity) {
+    return capacity / MAX_LOAD_DEN * MAX_LOAD_NUM;
+}
+
+static void allocate_buffer(quill_map_t *map, size_t capacity) {
+    size_t control_size = (capacity + GROUP_SIZE + 7) & ~(size_t) 7;
+    map->buffer = quill_alloc_alloc(
+        control_size + capacity * entry_size(map->type)
+    );
+    if(map->buffer == NULL) {
+        quill_panic(quill_string_from_static_cstr(
+            "Unable to allocate memory\n"
+        ));
+    }
+    map->control = (uint8_t *) map->buffer;
+    map->entries = map->control + control_size;
+    memset(map->control, CONTROL_EMPTY, capacity + GROUP_SIZE);
+    map->capacity = capacity;
+    map->growth_left = max_load(capacity);
+}
+
+void quill_map_init(quill_map_t *map, const quill_map_type_t *type) {
+    map->type = type;
+    map->buffer = NULL;
+    map->control = NULL;
+    map->entries = NULL;
+    map->capacity = 0;
+    map->length = 0;
+    map->growth_left = 0;
+}
+
+// Groups are visited in triangular steps, which reaches all of them
+// since the number of groups is a power of two.
+typedef struct quill_probe {
+    size_t position;
+    size_t stride;
+} quill_probe_t;
+
+static quill_probe_t probe_start(const quill_map_t *map, uint64_t hash) {
+    quill_probe_t probe = {
+        .position = (size_t) (hash >> 7) & (map->capacity - 1), .stride = 0
+    };
+    return probe;
+}
+
+static void probe_next(const quill_map_t *map, quill_probe_t *probe) {
+    probe->stride += GROUP_SIZE;
+    probe->position = (probe->position + probe->stride) & (map->capacity - 1);
+}
+
+// Returns the entry index of 'key', or 'map->capacity' if there is none.
+static size_t find(const quill_map_t *map, const void *key, uint64_t hash) {
+    if(map->capacity == 0) { return 0; }
+    uint8_t h2 = (uint8_t) (hash & 0x7F);
+    quill_probe_t probe = probe_start(map, hash);
+    for(;;) {
+        const uint8_t *group = map->control + probe.position;
+        quill_group_mask_t matches = group_match(group, h2);
+        while(matches != 0) {
+            size_t i = (probe.position + lowest_bit_i(matches))
+                & (map->capacity - 1);
+            if(map->type->eq(entry_at(map, i), key)) { return i; }
+            matches &= matches - 1;
+        }
+        if(group_match_empty(group) != 0) { return map->capacity; }
+        probe_next(map, &probe);
+    }
+}
+
+// Returns the first empty or deleted entry for 'hash'.
+static size_t find_free(const quill_map_t *map, uint64_t hash) {
+    quill_probe_t probe = probe_start(map, hash);
+    for(;;) {
+        quill_group_mask_t free_entries
+            = group_match_free(map->control + probe.position);
+        if(free_entries != 0) {
+            return (probe.position + lowest_bit_i(free_entries))
+                & (map->capacity - 1);
+        }
+        probe_next(map, &probe);
+    }
+}
+
+// Moves all entries into a new buffer, which also drops deleted entries.
+static void resize(quill_map_t *map, size_t capacity) {
+    quill_map_t old = *map;
+    allocate_buffer(map, capacity);
+    size_t size = entry_size(map->type);
+    for(size_t i = 0; i < old.capacity; i += 1) {
+        if((old.control[i] & 0x80) != 0) { continue; }
+        const uint8_t *entry = entry_at(&old, i);
+        uint64_t hash = map->type->hash(entry);
+        size_t dest = find_free(map, hash);
+        set_control(map, dest, old.control[i]);
+        memcpy(entry_at(map, dest), entry, size);
+    }
+    map->growth_left -= map->length;
+    if(old.buffer != NULL) { quill_alloc_free(old.buffer); }
+}
+
+static size_t capacity_for(size_t length) {
+    size_t capacity = GROUP_SIZE;
+    while(max_load(capacity) < length) { capacity *= 2; }
+    return capacity;
+}
+
+void quill_map_reserve(quill_map_t *map, size_t additional) {
+    size_t required = map->length + additional;
+    if(map->capacity != 0 && required <= max_load(map->capacity)
+        && additional <= map->growth_left) {
+        return;
+    }
+    size_t capacity = capacity_for(required);
+    if(capacity < map->capacity) { capacity = map->capacity; }
+    resize(map, capacity);
+}
+
+void *quill_map_get(const quill_map_t *map, const void *key) {
+    if(map->length == 0) { return NULL; }
+    size_t i = find(map, key, map->type->hash(key));
+    if(i == map->capacity) { return NULL; }
+    return entry_at(map, i) + value_offset(map->type);
+}
+
+void quill_map_set(quill_map_t *map, const void *key, const void *value) {
+    const quill_map_type_t *type = map->type;
+    uint64_t hash = type->hash(key);
+    size_t i = find(map, key, hash);
+    if(i != map->capacity) {
+        uint8_t *existing = entry_at(map, i) + value_offset(type);
+        quill_slot_rc_dec(type->value_kind, existing);
+        memcpy(existing, value, type->value_size);
+        quill_slot_rc_dec(type->key_kind, (const uint8_t *) key);
+        return;
+    }
+    if(map->growth_left == 0) {
+        // many deleted entries are cleared out without growing
+        size_t capacity = map->capacity;
+        if(capacity == 0) {
+            capacity = GROUP_SIZE;
+        } else if(map->length >= max_load(capacity) / 2) {
+            capacity *= 2;
+        }
+        resize(map, capacity);
+    }
+    i = find_free(map, hash);
+    // reusing a deleted entry doesn't use up an empty one
+    if(map->control[i] == CONTROL_EMPTY) { map->growth_left -= 1; }
+    set_control(map, i, (uint8_t) (hash & 0x7F));
+    uint8_t *entry = entry_at(map, i);
+    memcpy(entry, key, type->key_size);
+    memcpy(entry + value_offset(type), value, type->value_size);
+    map->length += 1;
+}
+
+quill_bool_t quill_map_remove(quill_map_t *map, const void *key) {
+    if(map->length == 0) { return QUILL_FALSE; }
+    const quill_map_type_t *type = map->type;
+    size_t i = find(map, key, type->hash(key));
+    if(i == map->capacity) { return QUILL_FALSE; }
+    uint8_t *entry = entry_at(map, i);
+    quill_slot_rc_dec(type->key_kind, entry);
+    quill_slot_rc_dec(type->value_kind, entry + value_offset(type));
+    // Lookups stop at the first group with an empty entry. If the groups
+    // starting at and ending with this entry both have one, no lookup can
+    // have gone past it and it can be marked as empty again.
+    size_t before = (i - GROUP_SIZE) & (map->capacity - 1);
+    quill_group_mask_t empty_after = group_match_empty(map->control + i);
+    quill_group_mask_t empty_before
+        = group_match_empty(map->control + before);
+    quill_bool_t was_never_full = empty_after != 0 && empty_before != 0
+        && lowest_bit_i(empty_after)
+            + (GROUP_SIZE - 1 - highest_bit_i(empty_before)) < GROUP_SIZE;
+    if(was_never_full) {
+        set_control(map, i, CONTROL_EMPTY);
+        map->growth_left += 1;
+    } else {
+        set_control(map, i, CONTROL_DELETED);
+    }
+    map->length -= 1;
+    return QUILL_TRUE;
+}
+
+quill_bool_t quill_map_next(
+    const quill_map_t *map, size_t *i, void **key, void **value
+) {
+    while(*i < map->capacity) {
+        size_t current = *i;
+        *i += 1;
+        if((map->control[current] & 0x80) != 0) { continue; }
+        uint8_t *entry = entry_at(map, current);
+        *key = entry;
+        *value = entry + value_offset(map->type);
+        return QUILL_TRUE;
+    }
+    return QUILL_FALSE;
+}
+
+void quill_map_traverse(
+    const quill_map_t *map, quill_visit_t visit, void *context
+) {
+    const quill_map_type_t *type = map->type;
+    for(size_t i = 0; i < map->capacity; i += 1) {
+        if((map->control[i] & 0x80) != 0) { continue; }
+        uint8_t *entry = entry_at(map, i);
+        quill_slot_visit(type->key_kind, entry, visit, context);
+        quill_slot_visit(
+            type->value_kind, entry + value_offset(type), visit, context
+        );
+    }
+}
+
+void quill_map_destroy(quill_map_t *map) {
+    const quill_map_type_t *type = map->type;
+    quill_bool_t has_refs = type->key_kind != QUILL_ENV_SLOT_PLAIN
+        || type->value_kind != QUILL_ENV_SLOT_PLAIN;
+    for(size_t i = 0; has_refs && i < map->capacity; i += 1) {
+        if((map->control[i] & 0x80) != 0) { continue; }
+        uint8_t *entry = entry_at(map, i);
+        quill_slot_rc_dec(type->key_kind, entry);
+        quill_slot_rc_dec(type->value_kind, entry + value_offset(type));
+    }
+    if(map->buffer != NULL) { quill_alloc_free(map->buffer); }
+    quill_map_init(map, type);
+}
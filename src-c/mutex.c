@@ -1,63 +1,395 @@
 
 #include <quill.h>
-#include <assert.h>
 
-#ifdef _WIN32
-    void quill_mutex_init(quill_mutex_t *mutex) {
-        InitializeCriticalSection(mutex);
+// 'wait_on' blocks while '*address' still holds 'expected', and may also
+// return spuriously. 'wake_one' and 'wake_all' wake threads waiting on
+// 'address' after its value was changed.
+
+#if defined(_WIN32)
+    #ifdef _MSC_VER
+        #pragma comment(lib, "synchronization.lib")
+    #endif
+
+    static void wait_on(_Atomic(uint32_t) *address, uint32_t expected) {
+        WaitOnAddress(
+            (volatile void *) address, &expected, sizeof(uint32_t), INFINITE
+        );
+    }
+
+    static void wake_one(_Atomic(uint32_t) *address) {
+        WakeByAddressSingle((void *) address);
     }
 
-    void quill_mutex_lock(quill_mutex_t *mutex) {
-        EnterCriticalSection(mutex);
+    static void wake_all(_Atomic(uint32_t) *address) {
+        WakeByAddressAll((void *) address);
     }
+#elif defined(__linux__)
+    #include <linux/futex.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+    #include <limits.h>
 
-    quill_bool_t quill_mutex_try_lock(quill_mutex_t *mutex) {
-        return (quill_bool_t) TryEnterCriticalSection(mutex);
+    static void wait_on(_Atomic(uint32_t) *address, uint32_t expected) {
+        syscall(
+            SYS_futex, (uint32_t *) address, FUTEX_WAIT_PRIVATE, expected,
+            NULL, NULL, 0
+        );
     }
 
-    void quill_mutex_unlock(quill_mutex_t *mutex) {
-        LeaveCriticalSection(mutex);
+    static void wake_one(_Atomic(uint32_t) *address) {
+        syscall(
+            SYS_futex, (uint32_t *) address, FUTEX_WAKE_PRIVATE, 1,
+            NULL, NULL, 0
+        );
     }
-    
-    void quill_mutex_destroy(quill_mutex_t *mutex) {
-        DeleteCriticalSection(mutex);
+
+    static void wake_all(_Atomic(uint32_t) *address) {
+        syscall(
+            SYS_futex, (uint32_t *) address, FUTEX_WAKE_PRIVATE, INT_MAX,
+            NULL, NULL, 0
+        );
     }
 #else
-    #include <errno.h>
+    // Without futexes waiting threads block on one of a fixed number of
+    // condition variables, selected by the address they wait on.
+    #define PARK_BUCKET_C 64
 
-    #ifndef PTHREAD_MUTEX_RECURSIVE
-        #define PTHREAD_MUTEX_RECURSIVE PTHREAD_MUTEX_RECURSIVE_NP
-    #endif
+    typedef struct quill_park_bucket {
+        pthread_mutex_t lock;
+        pthread_cond_t cond;
+    } quill_park_bucket_t;
 
-    static pthread_mutexattr_t mutex_attr;
-    static pthread_once_t mutex_attr_once = PTHREAD_ONCE_INIT;
+    static quill_park_bucket_t park_buckets[PARK_BUCKET_C];
+    static pthread_once_t park_buckets_once = PTHREAD_ONCE_INIT;
 
-    static void mutex_init_attr_once(void) {
-        pthread_mutexattr_init(&mutex_attr);
-        pthread_mutexattr_settype(&mutex_attr, PTHREAD_MUTEX_RECURSIVE);
+    static void init_park_buckets(void) {
+        for(size_t i = 0; i < PARK_BUCKET_C; i += 1) {
+            pthread_mutex_init(&park_buckets[i].lock, NULL);
+            pthread_cond_init(&park_buckets[i].cond, NULL);
+        }
     }
 
-    void quill_mutex_init(quill_mutex_t *mutex) {
-        pthread_once(&mutex_attr_once, &mutex_init_attr_once);
-        assert(pthread_mutex_init(mutex, &mutex_attr) == 0);
+    static quill_park_bucket_t *park_bucket(_Atomic(uint32_t) *address) {
+        pthread_once(&park_buckets_once, &init_park_buckets);
+        uintptr_t h = ((uintptr_t) address >> 2) * 0x9E3779B97F4A7C15ULL;
+        return &park_buckets[(h >> 32) % PARK_BUCKET_C];
     }
 
-    void quill_mutex_lock(quill_mutex_t *mutex) {
-        assert(pthread_mutex_lock(mutex) == 0);
+    static void wait_on(_Atomic(uint32_t) *address, uint32_t expected) {
+        quill_park_bucket_t *bucket = park_bucket(address);
+        pthread_mutex_lock(&bucket->lock);
+        if(atomic_load_explicit(address, memory_order_relaxed) == expected) {
+            pthread_cond_wait(&bucket->cond, &bucket->lock);
+        }
+        pthread_mutex_unlock(&bucket->lock);
     }
 
-    quill_bool_t quill_mutex_try_lock(quill_mutex_t *mutex) {
-        int r = pthread_mutex_trylock(mutex);
-        if(r == EBUSY) { return QUILL_FALSE; }
-        assert(r == 0);
+    static void wake_all(_Atomic(uint32_t) *address) {
+        quill_park_bucket_t *bucket = park_bucket(address);
+        pthread_mutex_lock(&bucket->lock);
+        pthread_cond_broadcast(&bucket->cond);
+        pthread_mutex_unlock(&bucket->lock);
+    }
+
+    // other addresses may share the condition variable
+    static void wake_one(_Atomic(uint32_t) *address) {
+        wake_all(address);
+    }
+#endif
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    #include <intrin.h>
+    #define SPIN_PAUSE() _mm_pause()
+#elif defined(__x86_64__) || defined(__i386__)
+    #define SPIN_PAUSE() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+    #define SPIN_PAUSE() __asm__ volatile("yield")
+#else
+    #define SPIN_PAUSE() ((void) 0)
+#endif
+
+// Most critical sections are short enough that the lock is released
+// before this many attempts, which is cheaper than blocking.
+#define MAX_SPIN_C 100
+
+#define MUTEX_UNLOCKED 0
+#define MUTEX_LOCKED 1
+#define MUTEX_CONTENDED 2
+
+// Unique among the threads that are running.
+static uintptr_t current_thread_id(void) {
+    static thread_local uint8_t marker;
+    return (uintptr_t) &marker;
+}
+
+static void init_mutex(quill_mutex_t *mutex, quill_bool_t recursive) {
+    atomic_store_explicit(&mutex->state, MUTEX_UNLOCKED, memory_order_relaxed);
+    mutex->recursive = recursive;
+    mutex->depth = 0;
+    atomic_store_explicit(&mutex->owner, 0, memory_order_relaxed);
+}
+
+void quill_mutex_init(quill_mutex_t *mutex) {
+    init_mutex(mutex, QUILL_FALSE);
+}
+
+void quill_mutex_init_recursive(quill_mutex_t *mutex) {
+    init_mutex(mutex, QUILL_TRUE);
+}
+
+static quill_bool_t try_lock_state(_Atomic(uint32_t) *state) {
+    uint32_t expected = MUTEX_UNLOCKED;
+    return atomic_compare_exchange_strong_explicit(
+        state, &expected, MUTEX_LOCKED,
+        memory_order_acquire, memory_order_relaxed
+    );
+}
+
+static void lock_state(_Atomic(uint32_t) *state) {
+    if(try_lock_state(state)) { return; }
+    for(size_t i = 0; i < MAX_SPIN_C; i += 1) {
+        SPIN_PAUSE();
+        uint32_t current = atomic_load_explicit(state, memory_order_relaxed);
+        // others are already blocked, so queue up behind them
+        if(current == MUTEX_CONTENDED) { break; }
+        if(current == MUTEX_UNLOCKED && try_lock_state(state)) { return; }
+    }
+    // whoever unlocks it next needs to wake a waiting thread
+    while(atomic_exchange_explicit(
+        state, MUTEX_CONTENDED, memory_order_acquire
+    ) != MUTEX_UNLOCKED) {
+        wait_on(state, MUTEX_CONTENDED);
+    }
+}
+
+static void unlock_state(_Atomic(uint32_t) *state) {
+    if(atomic_exchange_explicit(
+        state, MUTEX_UNLOCKED, memory_order_release
+    ) == MUTEX_CONTENDED) {
+        wake_one(state);
+    }
+}
+
+void quill_mutex_lock(quill_mutex_t *mutex) {
+    if(!mutex->recursive) {
+        lock_state(&mutex->state);
+        return;
+    }
+    uintptr_t self = current_thread_id();
+    // only equal if the lock is held by this thread
+    if(atomic_load_explicit(&mutex->owner, memory_order_relaxed) == self) {
+        mutex->depth += 1;
+        return;
+    }
+    lock_state(&mutex->state);
+    atomic_store_explicit(&mutex->owner, self, memory_order_relaxed);
+    mutex->depth = 1;
+}
+
+quill_bool_t quill_mutex_try_lock(quill_mutex_t *mutex) {
+    if(!mutex->recursive) { return try_lock_state(&mutex->state); }
+    uintptr_t self = current_thread_id();
+    if(atomic_load_explicit(&mutex->owner, memory_order_relaxed) == self) {
+        mutex->depth += 1;
         return QUILL_TRUE;
     }
+    if(!try_lock_state(&mutex->state)) { return QUILL_FALSE; }
+    atomic_store_explicit(&mutex->owner, self, memory_order_relaxed);
+    mutex->depth = 1;
+    return QUILL_TRUE;
+}
+
+void quill_mutex_unlock(quill_mutex_t *mutex) {
+    if(mutex->recursive) {
+        mutex->depth -= 1;
+        if(mutex->depth > 0) { return; }
+        atomic_store_explicit(&mutex->owner, 0, memory_order_relaxed);
+    }
+    unlock_state(&mutex->state);
+}
+
+void quill_mutex_destroy(quill_mutex_t *mutex) {
+    (void) mutex;
+}
+
+
+// The state of a reader-writer lock is the number of readers holding it
+// combined with the following flags.
+#define RWLOCK_WRITE_LOCKED ((uint32_t) 1 << 31)
+#define RWLOCK_WRITER_WAITING ((uint32_t) 1 << 30)
+// set by anyone before they block, cleared by the unlock that wakes them
+#define RWLOCK_WAITING ((uint32_t) 1 << 29)
+#define RWLOCK_READER_MASK (RWLOCK_WAITING - 1)
+
+void quill_rwlock_init(quill_rwlock_t *lock) {
+    atomic_store_explicit(&lock->state, 0, memory_order_relaxed);
+}
+
+// Sets the waiting flags of 'state' and blocks unless it changed.
+static void rwlock_block(
+    quill_rwlock_t *lock, uint32_t state, uint32_t flags
+) {
+    uint32_t waited = state | flags;
+    if(state != waited && !atomic_compare_exchange_weak_explicit(
+        &lock->state, &state, waited,
+        memory_order_relaxed, memory_order_relaxed
+    )) {
+        return;
+    }
+    wait_on(&lock->state, waited);
+}
+
+void quill_rwlock_read(quill_rwlock_t *lock) {
+    size_t spin_c = 0;
+    for(;;) {
+        uint32_t state = atomic_load_explicit(&lock->state, memory_order_relaxed);
+        if((state & (RWLOCK_WRITE_LOCKED | RWLOCK_WRITER_WAITING)) == 0) {
+            if(atomic_compare_exchange_weak_explicit(
+                &lock->state, &state, state + 1,
+                memory_order_acquire, memory_order_relaxed
+            )) {
+                return;
+            }
+            continue;
+        }
+        if(spin_c < MAX_SPIN_C) {
+            spin_c += 1;
+            SPIN_PAUSE();
+            continue;
+        }
+        rwlock_block(lock, state, RWLOCK_WAITING);
+    }
+}
+
+void quill_rwlock_unlock_read(quill_rwlock_t *lock) {
+    uint32_t state = atomic_fetch_sub_explicit(
+        &lock->state, 1, memory_order_release
+    );
+    // the last reader lets waiting writers in
+    if((state & RWLOCK_READER_MASK) != 1) { return; }
+    if((state & RWLOCK_WAITING) == 0) { return; }
+    atomic_fetch_and_explicit(
+        &lock->state, ~RWLOCK_WAITING, memory_order_relaxed
+    );
+    wake_all(&lock->state);
+}
+
+void quill_rwlock_write(quill_rwlock_t *lock) {
+    size_t spin_c = 0;
+    for(;;) {
+        uint32_t state = atomic_load_explicit(&lock->state, memory_order_relaxed);
+        if((state & (RWLOCK_WRITE_LOCKED | RWLOCK_READER_MASK)) == 0) {
+            // other waiting writers set their flag again once they fail
+            uint32_t locked = (state & RWLOCK_WAITING) | RWLOCK_WRITE_LOCKED;
+            if(atomic_compare_exchange_weak_explicit(
+                &lock->state, &state, locked,
+                memory_order_acquire, memory_order_relaxed
+            )) {
+                return;
+            }
+            continue;
+        }
+        if(spin_c < MAX_SPIN_C) {
+            spin_c += 1;
+            SPIN_PAUSE();
+            continue;
+        }
+        rwlock_block(lock, state, RWLOCK_WAITING | RWLOCK_WRITER_WAITING);
+    }
+}
+
+void quill_rwlock_unlock_write(quill_rwlock_t *lock) {
+    uint32_t state = atomic_exchange_explicit(
+        &lock->state, 0, memory_order_release
+    );
+    if((state & RWLOCK_WAITING) != 0) { wake_all(&lock->state); }
+}
+
+void quill_rwlock_destroy(quill_rwlock_t *lock) {
+    (void) lock;
+}
+
+
+void quill_cond_init(quill_cond_t *cond) {
+    atomic_store_explicit(&cond->sequence, 0, memory_order_relaxed);
+}
+
+void quill_cond_wait(quill_cond_t *cond, quill_mutex_t *mutex) {
+    uint32_t sequence
+        = atomic_load_explicit(&cond->sequence, memory_order_relaxed);
+    // recursive mutexes are released completely, no matter how often
+    // they are held, and then held as often as before again
+    uint32_t depth = 0;
+    if(mutex->recursive) {
+        depth = mutex->depth;
+        mutex->depth = 1;
+    }
+    quill_mutex_unlock(mutex);
+    // returns right away if signalled since the mutex was unlocked
+    wait_on(&cond->sequence, sequence);
+    // other threads may be waiting on the mutex after being woken
+    // together with this one, so its next unlock needs to wake them
+    while(atomic_exchange_explicit(
+        &mutex->state, MUTEX_CONTENDED, memory_order_acquire
+    ) != MUTEX_UNLOCKED) {
+        wait_on(&mutex->state, MUTEX_CONTENDED);
+    }
+    if(mutex->recursive) {
+        atomic_store_explicit(
+            &mutex->owner, current_thread_id(), memory_order_relaxed
+        );
+        mutex->depth = depth;
+    }
+}
+
+void quill_cond_signal(quill_cond_t *cond) {
+    atomic_fetch_add_explicit(&cond->sequence, 1, memory_order_relaxed);
+    wake_one(&cond->sequence);
+}
+
+void quill_cond_broadcast(quill_cond_t *cond) {
+    atomic_fetch_add_explicit(&cond->sequence, 1, memory_order_relaxed);
+    wake_all(&cond->sequence);
+}
+
+void quill_cond_destroy(quill_cond_t *cond) {
+    (void) cond;
+}
+
+
+#define EVENT_UNSET 0
+#define EVENT_SET 1
+#define EVENT_WAITED_ON 2
+
+void quill_event_init(quill_event_t *event) {
+    atomic_store_explicit(&event->state, EVENT_UNSET, memory_order_relaxed);
+}
+
+void quill_event_set(quill_event_t *event) {
+    if(atomic_exchange_explicit(
+        &event->state, EVENT_SET, memory_order_release
+    ) == EVENT_WAITED_ON) {
+        wake_all(&event->state);
+    }
+}
+
+quill_bool_t quill_event_is_set(quill_event_t *event) {
+    return atomic_load_explicit(&event->state, memory_order_acquire)
+        == EVENT_SET;
+}
 
-    void quill_mutex_unlock(quill_mutex_t *mutex) {
-        assert(pthread_mutex_unlock(mutex) == 0);
+void quill_event_wait(quill_event_t *event) {
+    for(size_t i = 0; i < MAX_SPIN_C; i += 1) {
+        if(quill_event_is_set(event)) { return; }
+        SPIN_PAUSE();
     }
-    
-    void quill_mutex_destroy(quill_mutex_t *mutex) {
-        assert(pthread_mutex_destroy(mutex) == 0);
+    for(;;) {
+        uint32_t state = EVENT_UNSET;
+        atomic_compare_exchange_strong_explicit(
+            &event->state, &state, EVENT_WAITED_ON,
+            memory_order_acquire, memory_order_acquire
+        );
+        if(state == EVENT_SET) { return; }
+        wait_on(&event->state, EVENT_WAITED_ON);
     }
-#endif
\ No newline at end of file
+}
@@ -0,0 +1,555 @@
+#include <quill.h>
+#include <string.h>
+
+static const char digit_pairs[200] = {
+    '0','0','0','1','0','2','0','3','0','4','0','5','0','6','0','7','0','8','0','9',
+    '1','0','1','1','1','2','1','3','1','4','1','5','1','6','1','7','1','8','1','9',
+    '2','0','2','1','2','2','2','3','2','4','2','5','2','6','2','7','2','8','2','9',
+    '3','0','3','1','3','2','3','3','3','4','3','5','3','6','3','7','3','8','3','9',
+    '4','0','4','1','4','2','4','3','4','4','4','5','4','6','4','7','4','8','4','9',
+    '5','0','5','1','5','2','5','3','5','4','5','5','5','6','5','7','5','8','5','9',
+    '6','0','6','1','6','2','6','3','6','4','6','5','6','6','6','7','6','8','6','9',
+    '7','0','7','1','7','2','7','3','7','4','7','5','7','6','7','7','7','8','7','9',
+    '8','0','8','1','8','2','8','3','8','4','8','5','8','6','8','7','8','8','8','9',
+    '9','0','9','1','9','2','9','3','9','4','9','5','9','6','9','7','9','8','9','9'
+};
+
+static const uint64_t powers_of_10[20] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+    10000000ULL, 100000000ULL, 1000000000ULL, 10000000000ULL,
+    100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+    100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+    100000000000000000ULL, 1000000000000000000ULL,
+    10000000000000000000ULL
+};
+
+static size_t decimal_digit_c(uint64_t n) {
+    size_t digit_c = 1;
+    while(digit_c < 20 && n >= powers_of_10[digit_c]) { digit_c += 1; }
+    return digit_c;
+}
+
+// Writes the digits of 'n' two at a time, starting from the end.
+static void write_digits(uint64_t n, uint8_t *dest, size_t digit_c) {
+    uint8_t *end = dest + digit_c;
+    while(n >= 100) {
+        size_t pair = (size_t) (n % 100) * 2;
+        n /= 100;
+        end -= 2;
+        end[0] = (uint8_t) digit_pairs[pair];
+        end[1] = (uint8_t) digit_pairs[pair + 1];
+    }
+    if(n >= 10) {
+        end -= 2;
+        end[0] = (uint8_t) digit_pairs[n * 2];
+        end[1] = (uint8_t) digit_pairs[n * 2 + 1];
+    } else {
+        end -= 1;
+        end[0] = (uint8_t) ('0' + n);
+    }
+}
+
+quill_int_t quill_int_format(quill_int_t i, uint8_t *dest) {
+    quill_int_t length_bytes = 0;
+    // negated as unsigned, so that the smallest value works too
+    uint64_t n = (uint64_t) i;
+    if(i < 0) {
+        n = (uint64_t) 0 - n;
+        dest[0] = '-';
+        length_bytes = 1;
+    }
+    size_t digit_c = decimal_digit_c(n);
+    write_digits(n, dest + length_bytes, digit_c);
+    return length_bytes + (quill_int_t) digit_c;
+}
+
+
+// Shortest float formatting using Grisu2 (Loitsch, "Printing Floating-Point
+// Numbers Quickly and Accurately with Integers"), as done by RapidJSON.
+// The output always parses back to the same value and is the shortest such
+// representation for nearly all inputs; the rest get one more digit.
+
+typedef struct quill_diy_fp {
+    uint64_t f;
+    int e;
+} quill_diy_fp_t;
+
+#define DP_SIGNIFICAND_BITS 52
+#define DP_EXPONENT_BIAS (0x3FF + DP_SIGNIFICAND_BITS)
+#define DP_HIDDEN_BIT ((uint64_t) 1 << DP_SIGNIFICAND_BITS)
+#define DP_SIGNIFICAND_MASK (DP_HIDDEN_BIT - 1)
+
+// 10^-348, 10^-340, ..., 10^340 as normalized 64 bit significands
+static const quill_diy_fp_t cached_powers[87] = {
+        { 0xFA8FD5A0081C0288ULL, -1220 },
+        { 0xBAAEE17FA23EBF76ULL, -1193 },
+        { 0x8B16FB203055AC76ULL, -1166 },
+        { 0xCF42894A5DCE35EAULL, -1140 },
+        { 0x9A6BB0AA55653B2DULL, -1113 },
+        { 0xE61ACF033D1A45DFULL, -1087 },
+        { 0xAB70FE17C79AC6CAULL, -1060 },
+        { 0xFF77B1FCBEBCDC4FULL, -1034 },
+        { 0xBE5691EF416BD60CULL, -1007 },
+        { 0x8DD01FAD907FFC3CULL, -980 },
+        { 0xD3515C2831559A83ULL, -954 },
+        { 0x9D71AC8FADA6C9B5ULL, -927 },
+        { 0xEA9C227723EE8BCBULL, -901 },
+        { 0xAECC49914078536DULL, -874 },
+        { 0x823C12795DB6CE57ULL, -847 },
+        { 0xC21094364DFB5637ULL, -821 },
+        { 0x9096EA6F3848984FULL, -794 },
+        { 0xD77485CB25823AC7ULL, -768 },
+        { 0xA086CFCD97BF97F4ULL, -741 },
+        { 0xEF340A98172AACE5ULL, -715 },
+        { 0xB23867FB2A35B28EULL, -688 },
+        { 0x84C8D4DFD2C63F3BULL, -661 },
+        { 0xC5DD44271AD3CDBAULL, -635 },
+        { 0x936B9FCEBB25C996ULL, -608 },
+        { 0xDBAC6C247D62A584ULL, -582 },
+        { 0xA3AB66580D5FDAF6ULL, -555 },
+        { 0xF3E2F893DEC3F126ULL, -529 },
+        { 0xB5B5ADA8AAFF80B8ULL, -502 },
+        { 0x87625F056C7C4A8BULL, -475 },
+        { 0xC9BCFF6034C13053ULL, -449 },
+        { 0x964E858C91BA2655ULL, -422 },
+        { 0xDFF9772470297EBDULL, -396 },
+        { 0xA6DFBD9FB8E5B88FULL, -369 },
+        { 0xF8A95FCF88747D94ULL, -343 },
+        { 0xB94470938FA89BCFULL, -316 },
+        { 0x8A08F0F8BF0F156BULL, -289 },
+        { 0xCDB02555653131B6ULL, -263 },
+        { 0x993FE2C6D07B7FACULL, -236 },
+        { 0xE45C10C42A2B3B06ULL, -210 },
+        { 0xAA242499697392D3ULL, -183 },
+        { 0xFD87B5F28300CA0EULL, -157 },
+        { 0xBCE5086492111AEBULL, -130 },
+        { 0x8CBCCC096F5088CCULL, -103 },
+        { 0xD1B71758E219652CULL, -77 },
+        { 0x9C40000000000000ULL, -50 },
+        { 0xE8D4A51000000000ULL, -24 },
+        { 0xAD78EBC5AC620000ULL, 3 },
+        { 0x813F3978F8940984ULL, 30 },
+        { 0xC097CE7BC90715B3ULL, 56 },
+        { 0x8F7E32CE7BEA5C70ULL, 83 },
+        { 0xD5D238A4ABE98068ULL, 109 },
+        { 0x9F4F2726179A2245ULL, 136 },
+        { 0xED63A231D4C4FB27ULL, 162 },
+        { 0xB0DE65388CC8ADA8ULL, 189 },
+        { 0x83C7088E1AAB65DBULL, 216 },
+        { 0xC45D1DF942711D9AULL, 242 },
+        { 0x924D692CA61BE758ULL, 269 },
+        { 0xDA01EE641A708DEAULL, 295 },
+        { 0xA26DA3999AEF774AULL, 322 },
+        { 0xF209787BB47D6B85ULL, 348 },
+        { 0xB454E4A179DD1877ULL, 375 },
+        { 0x865B86925B9BC5C2ULL, 402 },
+        { 0xC83553C5C8965D3DULL, 428 },
+        { 0x952AB45CFA97A0B3ULL, 455 },
+        { 0xDE469FBD99A05FE3ULL, 481 },
+        { 0xA59BC234DB398C25ULL, 508 },
+        { 0xF6C69A72A3989F5CULL, 534 },
+        { 0xB7DCBF5354E9BECEULL, 561 },
+        { 0x88FCF317F22241E2ULL, 588 },
+        { 0xCC20CE9BD35C78A5ULL, 614 },
+        { 0x98165AF37B2153DFULL, 641 },
+        { 0xE2A0B5DC971F303AULL, 667 },
+        { 0xA8D9D1535CE3B396ULL, 694 },
+        { 0xFB9B7CD9A4A7443CULL, 720 },
+        { 0xBB764C4CA7A44410ULL, 747 },
+        { 0x8BAB8EEFB6409C1AULL, 774 },
+        { 0xD01FEF10A657842CULL, 800 },
+        { 0x9B10A4E5E9913129ULL, 827 },
+        { 0xE7109BFBA19C0C9DULL, 853 },
+        { 0xAC2820D9623BF429ULL, 880 },
+        { 0x80444B5E7AA7CF85ULL, 907 },
+        { 0xBF21E44003ACDD2DULL, 933 },
+        { 0x8E679C2F5E44FF8FULL, 960 },
+        { 0xD433179D9C8CB841ULL, 986 },
+        { 0x9E19DB92B4E31BA9ULL, 1013 },
+        { 0xEB96BF6EBADF77D9ULL, 1039 },
+        { 0xAF87023B9BF0EE6BULL, 1066 },
+};
+
+static quill_diy_fp_t diy_fp_mul(quill_diy_fp_t a, quill_diy_fp_t b) {
+    uint64_t a_hi = a.f >> 32;
+    uint64_t a_lo = a.f & 0xFFFFFFFF;
+    uint64_t b_hi = b.f >> 32;
+    uint64_t b_lo = b.f & 0xFFFFFFFF;
+    uint64_t hi_hi = a_hi * b_hi;
+    uint64_t hi_lo = a_hi * b_lo;
+    uint64_t lo_hi = a_lo * b_hi;
+    uint64_t lo_lo = a_lo * b_lo;
+    uint64_t mid = (lo_lo >> 32) + (hi_lo & 0xFFFFFFFF) + (lo_hi & 0xFFFFFFFF);
+    // round the lower half
+    mid += (uint64_t) 1 << 31;
+    return (quill_diy_fp_t) {
+        .f = hi_hi + (hi_lo >> 32) + (lo_hi >> 32) + (mid >> 32),
+        .e = a.e + b.e + 64
+    };
+}
+
+static quill_diy_fp_t diy_fp_normalize(quill_diy_fp_t v) {
+    while((v.f & ((uint64_t) 1 << 63)) == 0) {
+        v.f <<= 1;
+        v.e -= 1;
+    }
+    return v;
+}
+
+static void write_grisu_round(
+    uint8_t *digits, size_t digit_c, uint64_t delta, uint64_t rest,
+    uint64_t ten_kappa, uint64_t wp_w
+) {
+    while(rest < wp_w && delta - rest >= ten_kappa
+        && (rest + ten_kappa < wp_w
+            || wp_w - rest > rest + ten_kappa - wp_w)) {
+        digits[digit_c - 1] -= 1;
+        rest += ten_kappa;
+    }
+}
+
+// Writes the digits of a value between 'w_minus' and 'w_plus' (scaled by
+// 10^-k) that is closest to 'w'. The value is 'digits' * 10^'k'.
+static size_t generate_digits(
+    quill_diy_fp_t w, quill_diy_fp_t w_plus, uint64_t delta,
+    uint8_t *digits, int *k
+) {
+    quill_diy_fp_t one = {
+        .f = (uint64_t) 1 << -w_plus.e, .e = w_plus.e
+    };
+    uint64_t wp_w = w_plus.f - w.f;
+    uint32_t p1 = (uint32_t) (w_plus.f >> -one.e);
+    uint64_t p2 = w_plus.f & (one.f - 1);
+    int kappa = (int) decimal_digit_c(p1);
+    size_t digit_c = 0;
+    while(kappa > 0) {
+        uint32_t divisor = (uint32_t) powers_of_10[kappa - 1];
+        uint32_t d = p1 / divisor;
+        p1 %= divisor;
+        if(d != 0 || digit_c != 0) {
+            digits[digit_c] = (uint8_t) ('0' + d);
+            digit_c += 1;
+        }
+        kappa -= 1;
+        uint64_t rest = ((uint64_t) p1 << -one.e) + p2;
+        if(rest <= delta) {
+            *k += kappa;
+            write_grisu_round(
+                digits, digit_c, delta, rest,
+                powers_of_10[kappa] << -one.e, wp_w
+            );
+            return digit_c;
+        }
+    }
+    for(;;) {
+        p2 *= 10;
+        delta *= 10;
+        uint8_t d = (uint8_t) (p2 >> -one.e);
+        if(d != 0 || digit_c != 0) {
+            digits[digit_c] = (uint8_t) ('0' + d);
+            digit_c += 1;
+        }
+        p2 &= one.f - 1;
+        kappa -= 1;
+        if(p2 < delta) {
+            *k += kappa;
+            int i = -kappa;
+            write_grisu_round(
+                digits, digit_c, delta, p2, one.f,
+                wp_w * (i < 20 ? powers_of_10[i] : 0)
+            );
+            return digit_c;
+        }
+    }
+}
+
+// 'f' must be finite and larger than zero.
+static size_t grisu2(double f, uint8_t *digits, int *k) {
+    uint64_t bits;
+    memcpy(&bits, &f, sizeof(uint64_t));
+    int biased_e = (int) ((bits >> DP_SIGNIFICAND_BITS) & 0x7FF);
+    quill_diy_fp_t v = { .f = bits & DP_SIGNIFICAND_MASK, .e = 0 };
+    if(biased_e != 0) {
+        v.f += DP_HIDDEN_BIT;
+        v.e = biased_e - DP_EXPONENT_BIAS;
+    } else {
+        v.e = 1 - DP_EXPONENT_BIAS;
+    }
+    // the boundaries halfway to the neighbouring values
+    quill_diy_fp_t plus = diy_fp_normalize((quill_diy_fp_t) {
+        .f = (v.f << 1) + 1, .e = v.e - 1
+    });
+    quill_diy_fp_t minus = v.f == DP_HIDDEN_BIT
+        ? (quill_diy_fp_t) { .f = (v.f << 2) - 1, .e = v.e - 2 }
+        : (quill_diy_fp_t) { .f = (v.f << 1) - 1, .e = v.e - 1 };
+    minus.f <<= minus.e - plus.e;
+    minus.e = plus.e;
+    // a power of ten that scales 'plus' to an exponent in [-60, -32]
+    double dk = (-61 - plus.e) * 0.30102999566398114 + 347;
+    int cached_k = (int) dk;
+    if(dk - cached_k > 0.0) { cached_k += 1; }
+    size_t index = (size_t) ((cached_k >> 3) + 1);
+    *k = -(-348 + (int) index * 8);
+    quill_diy_fp_t c = cached_powers[index];
+    quill_diy_fp_t w = diy_fp_mul(diy_fp_normalize(v), c);
+    quill_diy_fp_t w_plus = diy_fp_mul(plus, c);
+    quill_diy_fp_t w_minus = diy_fp_mul(minus, c);
+    // the products may be off by one in either direction
+    w_minus.f += 1;
+    w_plus.f -= 1;
+    return generate_digits(w, w_plus, w_plus.f - w_minus.f, digits, k);
+}
+
+static size_t write_exponent(int e, uint8_t *dest) {
+    size_t length = 0;
+    if(e < 0) {
+        dest[0] = '-';
+        length = 1;
+        e = -e;
+    }
+    size_t digit_c = decimal_digit_c((uint64_t) e);
+    write_digits((uint64_t) e, dest + length, digit_c);
+    return length + digit_c;
+}
+
+// Numbers with more than this many digits before the decimal point,
+// or more than this many zeros after it, are written with an exponent.
+#define MAX_INTEGER_DIGITS 21
+#define MAX_LEADING_ZEROS 6
+
+quill_int_t quill_float_format(quill_float_t f, uint8_t *dest) {
+    if(isnan(f)) {
+        memcpy(dest, "nan", 3);
+        return 3;
+    }
+    if(isinf(f)) {
+        if(f > 0) {
+            memcpy(dest, "inf", 3);
+            return 3;
+        }
+        memcpy(dest, "-inf", 4);
+        return 4;
+    }
+    size_t length = 0;
+    if(signbit(f)) {
+        dest[0] = '-';
+        length = 1;
+        f = -f;
+    }
+    if(f == 0.0) {
+        dest[length] = '0';
+        return (quill_int_t) length + 1;
+    }
+    uint8_t *out = dest + length;
+    int k;
+    size_t digit_c = grisu2(f, out, &k);
+    // the position of the decimal point relative to the first digit
+    int point = (int) digit_c + k;
+    if(k >= 0 && point <= MAX_INTEGER_DIGITS) {
+        // 1234e2 -> 123400
+        memset(out + digit_c, '0', (size_t) k);
+        return (quill_int_t) (length + (size_t) point);
+    }
+    if(point > 0 && point <= MAX_INTEGER_DIGITS) {
+        // 1234e-2 -> 12.34
+        memmove(out + point + 1, out + point, digit_c - (size_t) point);
+        out[point] = '.';
+        return (quill_int_t) (length + digit_c + 1);
+    }
+    if(point <= 0 && point > -MAX_LEADING_ZEROS) {
+        // 1234e-6 -> 0.001234
+        size_t offset = (size_t) (2 - point);
+        memmove(out + offset, out, digit_c);
+        out[0] = '0';
+        out[1] = '.';
+        memset(out + 2, '0', (size_t) -point);
+        return (quill_int_t) (length + offset + digit_c);
+    }
+    // 1234e30 -> 1.234e33
+    size_t mantissa_length = 1;
+    if(digit_c > 1) {
+        memmove(out + 2, out + 1, digit_c - 1);
+        out[1] = '.';
+        mantissa_length = digit_c + 1;
+    }
+    out[mantissa_length] = 'e';
+    size_t exponent_length = write_exponent(point - 1, out + mantissa_length + 1);
+    return (quill_int_t) (length + mantissa_length + 1 + exponent_length);
+}
+
+
+quill_bool_t quill_int_parse(
+    const uint8_t *data, size_t length_bytes, quill_int_t *dest
+) {
+    size_t i = 0;
+    quill_bool_t negative = QUILL_FALSE;
+    if(length_bytes > 0 && (data[0] == '-' || data[0] == '+')) {
+        negative = data[0] == '-';
+        i = 1;
+    }
+    if(i == length_bytes) { return QUILL_FALSE; }
+    uint64_t n = 0;
+    // 19 digits can't overflow, the 20th needs to be checked
+    size_t unchecked_end = i + 19 < length_bytes ? i + 19 : length_bytes;
+    for(; i < unchecked_end; i += 1) {
+        uint8_t d = (uint8_t) (data[i] - '0');
+        if(d > 9) { return QUILL_FALSE; }
+        n = n * 10 + d;
+    }
+    for(; i < length_bytes; i += 1) {
+        uint8_t d = (uint8_t) (data[i] - '0');
+        if(d > 9) { return QUILL_FALSE; }
+        if(n > (UINT64_MAX - d) / 10) { return QUILL_FALSE; }
+        n = n * 10 + d;
+    }
+    uint64_t limit = negative
+        ? (uint64_t) INT64_MAX + 1 : (uint64_t) INT64_MAX;
+    if(n > limit) { return QUILL_FALSE; }
+    *dest = negative ? (quill_int_t) ((uint64_t) 0 - n) : (quill_int_t) n;
+    return QUILL_TRUE;
+}
+
+static quill_bool_t matches(
+    const uint8_t *data, size_t length_bytes, const char *expected
+) {
+    size_t expected_length = strlen(expected);
+    return length_bytes == expected_length
+        && memcmp(data, expected, expected_length) == 0;
+}
+
+// Doubles represent all integers up to 2^53 and powers of ten up to 10^22
+// exactly, so dividing or multiplying two such values is correctly rounded
+// (Clinger, "How to Read Floating Point Numbers Accurately").
+static const double exact_powers_of_10[23] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+#define MAX_EXACT_SIGNIFICAND ((uint64_t) 1 << 53)
+#define MAX_EXACT_EXPONENT 22
+// longer inputs are copied to the heap for 'strtod'
+#define STRTOD_BUFFER_SIZE 64
+
+// 'mantissa_length' is the number of bytes before the exponent. 'strtod'
+// expects the decimal point of the current locale, so it only gets the
+// sign and digits, with the point moved into 'exponent'.
+static double parse_slow(
+    const uint8_t *data, size_t mantissa_length, int64_t exponent
+) {
+    size_t size = mantissa_length + 1 + QUILL_INT_FORMAT_MAX + 1;
+    char buffer[STRTOD_BUFFER_SIZE];
+    char *cstr = buffer;
+    if(size > STRTOD_BUFFER_SIZE) {
+        cstr = malloc(size);
+        if(cstr == NULL) {
+            quill_panic(quill_string_from_static_cstr(
+                "Unable to allocate memory\n"
+            ));
+        }
+    }
+    size_t length = 0;
+    for(size_t i = 0; i < mantissa_length; i += 1) {
+        if(data[i] == '.') { continue; }
+        cstr[length] = (char) data[i];
+        length += 1;
+    }
+    cstr[length] = 'e';
+    length += 1;
+    length += (size_t) quill_int_format(exponent, (uint8_t *) cstr + length);
+    cstr[length] = '\0';
+    double f = strtod(cstr, NULL);
+    if(cstr != buffer) { free(cstr); }
+    return f;
+}
+
+quill_bool_t quill_float_parse(
+    const uint8_t *data, size_t length_bytes, quill_float_t *dest
+) {
+    if(matches(data, length_bytes, "nan")) {
+        *dest = NAN;
+        return QUILL_TRUE;
+    }
+    if(matches(data, length_bytes, "inf")) {
+        *dest = INFINITY;
+        return QUILL_TRUE;
+    }
+    if(matches(data, length_bytes, "-inf")) {
+        *dest = -INFINITY;
+        return QUILL_TRUE;
+    }
+    size_t i = 0;
+    quill_bool_t negative = QUILL_FALSE;
+    if(length_bytes > 0 && (data[0] == '-' || data[0] == '+')) {
+        negative = data[0] == '-';
+        i = 1;
+    }
+    // the significand without the decimal point, as far as it fits
+    uint64_t significand = 0;
+    size_t digit_c = 0;
+    size_t dropped_digit_c = 0;
+    int64_t exponent = 0;
+    int64_t fraction_digit_c = 0;
+    quill_bool_t seen_point = QUILL_FALSE;
+    for(; i < length_bytes; i += 1) {
+        uint8_t c = data[i];
+        if(c == '.' && !seen_point) {
+            seen_point = QUILL_TRUE;
+            continue;
+        }
+        uint8_t d = (uint8_t) (c - '0');
+        if(d > 9) { break; }
+        digit_c += 1;
+        if(seen_point) { fraction_digit_c += 1; }
+        if(significand < 100000000000000000ULL) {
+            significand = significand * 10 + d;
+            if(seen_point) { exponent -= 1; }
+        } else {
+            dropped_digit_c += 1;
+            if(!seen_point) { exponent += 1; }
+        }
+    }
+    if(digit_c == 0) { return QUILL_FALSE; }
+    size_t mantissa_length = i;
+    int64_t written_exponent = 0;
+    if(i < length_bytes) {
+        if(data[i] != 'e' && data[i] != 'E') { return QUILL_FALSE; }
+        i += 1;
+        quill_bool_t negative_exponent = QUILL_FALSE;
+        if(i < length_bytes && (data[i] == '-' || data[i] == '+')) {
+            negative_exponent = data[i] == '-';
+            i += 1;
+        }
+        if(i == length_bytes) { return QUILL_FALSE; }
+        for(; i < length_bytes; i += 1) {
+            uint8_t d = (uint8_t) (data[i] - '0');
+            if(d > 9) { return QUILL_FALSE; }
+            // anything this large is zero or infinity anyway
+            if(written_exponent < 100000) {
+                written_exponent = written_exponent * 10 + d;
+            }
+        }
+        if(negative_exponent) { written_exponent = -written_exponent; }
+        exponent += written_exponent;
+    }
+    double f;
+    if(dropped_digit_c == 0 && significand <= MAX_EXACT_SIGNIFICAND
+        && exponent >= -MAX_EXACT_EXPONENT
+        && exponent <= MAX_EXACT_EXPONENT) {
+        f = (double) significand;
+        if(exponent < 0) {
+            f /= exact_powers_of_10[-exponent];
+        } else {
+            f *= exact_powers_of_10[exponent];
+        }
+        if(negative) { f = -f; }
+    } else {
+        // the syntax has been checked, so 'strtod' reads all of it
+        f = parse_slow(
+            data, mantissa_length, written_exponent - fraction_digit_c
+        );
+    }
+    // finite inputs too large for a double
+    if(isinf(f)) { return QUILL_FALSE; }
+    *dest = f;
+    return QUILL_TRUE;
+}
@@ -0,0 +1,297 @@
+#include <quill.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#if defined(_WIN32)
+    #define CAPTURE_STACK(pcs, n) \
+        ((size_t) CaptureStackBackTrace(0, (DWORD) (n), (pcs), NULL))
+#elif defined(__GLIBC__) || defined(__APPLE__)
+    #include <execinfo.h>
+    #define CAPTURE_STACK(pcs, n) ((size_t) backtrace((pcs), (int) (n)))
+#else
+    #define CAPTURE_STACK(pcs, n) ((void) (pcs), (size_t) 0)
+#endif
+
+#define MAX_STACK_DEPTH 32
+// 'quill_profile_record_alloc' and 'quill_alloc_alloc'
+#define SKIPPED_FRAME_C 2
+
+#define BUCKET_TABLE_SIZE 4096
+#define SAMPLE_TABLE_SIZE 16384
+
+// The profiler uses the system allocator, so that its own memory
+// does not show up in the profile.
+typedef struct quill_profile_bucket quill_profile_bucket_t;
+
+typedef struct quill_profile_bucket {
+    quill_profile_bucket_t *next;
+    uint64_t hash;
+    size_t depth;
+    void *pcs[MAX_STACK_DEPTH];
+    uint64_t alloc_c;
+    uint64_t alloc_size;
+    uint64_t free_c;
+    uint64_t free_size;
+} quill_profile_bucket_t;
+
+typedef struct quill_profile_sample quill_profile_sample_t;
+
+typedef struct quill_profile_sample {
+    quill_profile_sample_t *next;
+    void *alloc;
+    size_t size;
+    quill_profile_bucket_t *bucket;
+} quill_profile_sample_t;
+
+static _Atomic(size_t) sample_size = 0;
+// written to dumps, so stopping the profiler doesn't lose the rate
+static _Atomic(size_t) recorded_sample_size = 0;
+
+// Only held briefly - nothing is allocated or written while holding it.
+// Buckets are never freed, and only their counts change once added.
+static quill_mutex_t profile_lock;
+static quill_profile_bucket_t *buckets[BUCKET_TABLE_SIZE];
+static size_t bucket_c = 0;
+static quill_profile_sample_t *samples[SAMPLE_TABLE_SIZE];
+
+static thread_local uint64_t thread_random = 0;
+
+static uint64_t next_random(void) {
+    uint64_t x = thread_random;
+    if(x == 0) {
+        x = ((uint64_t) (uintptr_t) &thread_random ^ (uint64_t) time(NULL))
+            * 0x9E3779B97F4A7C15ULL;
+        x |= 1;
+    }
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    thread_random = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+void quill_alloc_profile_start(size_t new_sample_size) {
+    atomic_store_explicit(&sample_size, new_sample_size, memory_order_relaxed);
+    if(new_sample_size == 0) { return; }
+    atomic_store_explicit(
+        &recorded_sample_size, new_sample_size, memory_order_relaxed
+    );
+}
+
+size_t quill_profile_sample_interval(void) {
+    size_t mean = atomic_load_explicit(&sample_size, memory_order_relaxed);
+    if(mean == 0) { return 0; }
+    // exponentially distributed intervals make the samples a Poisson
+    // process, which is what pprof assumes when scaling them back up
+    double u = (double) ((next_random() >> 11) + 1) / 9007199254740993.0;
+    return (size_t) (-log(u) * (double) mean) + 1;
+}
+
+static uint64_t hash_stack(void **pcs, size_t depth) {
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for(size_t i = 0; i < depth; i += 1) {
+        hash ^= (uint64_t) (uintptr_t) pcs[i];
+        hash *= 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+static size_t sample_slot(void *alloc) {
+    return (size_t) (((uintptr_t) alloc >> 4) * 0x9E3779B97F4A7C15ULL >> 32)
+        & (SAMPLE_TABLE_SIZE - 1);
+}
+
+// The profile needs to be locked.
+static quill_profile_bucket_t *find_bucket(
+    void **pcs, size_t depth, uint64_t hash
+) {
+    quill_profile_bucket_t *bucket = buckets[hash & (BUCKET_TABLE_SIZE - 1)];
+    for(; bucket != NULL; bucket = bucket->next) {
+        if(bucket->hash != hash || bucket->depth != depth) { continue; }
+        if(memcmp(bucket->pcs, pcs, sizeof(void *) * depth) == 0) {
+            return bucket;
+        }
+    }
+    return NULL;
+}
+
+// Locks the profile and returns the bucket of the stack, which is
+// allocated without holding the lock if the stack is new.
+static quill_profile_bucket_t *lock_bucket(void **pcs, size_t depth) {
+    uint64_t hash = hash_stack(pcs, depth);
+    quill_mutex_lock(&profile_lock);
+    quill_profile_bucket_t *bucket = find_bucket(pcs, depth, hash);
+    if(bucket != NULL) { return bucket; }
+    quill_mutex_unlock(&profile_lock);
+    quill_profile_bucket_t *created = calloc(1, sizeof(quill_profile_bucket_t));
+    if(created == NULL) { return NULL; }
+    created->hash = hash;
+    created->depth = depth;
+    memcpy(created->pcs, pcs, sizeof(void *) * depth);
+    quill_mutex_lock(&profile_lock);
+    // another thread may have added the same stack in the meantime
+    bucket = find_bucket(pcs, depth, hash);
+    if(bucket != NULL) {
+        free(created);
+        return bucket;
+    }
+    quill_profile_bucket_t **head = &buckets[hash & (BUCKET_TABLE_SIZE - 1)];
+    created->next = *head;
+    *head = created;
+    bucket_c += 1;
+    return created;
+}
+
+void quill_profile_record_alloc(void *alloc, size_t n) {
+    void *pcs[MAX_STACK_DEPTH + SKIPPED_FRAME_C];
+    size_t depth = CAPTURE_STACK(pcs, MAX_STACK_DEPTH + SKIPPED_FRAME_C);
+    size_t skipped = depth < SKIPPED_FRAME_C ? depth : SKIPPED_FRAME_C;
+    quill_profile_sample_t *sample = malloc(sizeof(quill_profile_sample_t));
+    if(sample == NULL) { return; }
+    quill_profile_bucket_t *bucket = lock_bucket(
+        pcs + skipped, depth - skipped
+    );
+    if(bucket == NULL) {
+        free(sample);
+        return;
+    }
+    bucket->alloc_c += 1;
+    bucket->alloc_size += n;
+    quill_profile_sample_t **head = &samples[sample_slot(alloc)];
+    sample->alloc = alloc;
+    sample->size = n;
+    sample->bucket = bucket;
+    sample->next = *head;
+    *head = sample;
+    quill_mutex_unlock(&profile_lock);
+}
+
+quill_bool_t quill_profile_record_free(void *alloc) {
+    quill_mutex_lock(&profile_lock);
+    quill_profile_sample_t **link = &samples[sample_slot(alloc)];
+    for(; *link != NULL; link = &(*link)->next) {
+        quill_profile_sample_t *sample = *link;
+        if(sample->alloc != alloc) { continue; }
+        *link = sample->next;
+        sample->bucket->free_c += 1;
+        sample->bucket->free_size += sample->size;
+        quill_mutex_unlock(&profile_lock);
+        free(sample);
+        return QUILL_TRUE;
+    }
+    quill_mutex_unlock(&profile_lock);
+    return QUILL_FALSE;
+}
+
+typedef struct quill_profile_counts {
+    const quill_profile_bucket_t *bucket;
+    uint64_t alloc_c;
+    uint64_t alloc_size;
+    uint64_t free_c;
+    uint64_t free_size;
+} quill_profile_counts_t;
+
+// Returns the counts of all buckets as they were at one point in time,
+// or NULL if there is not enough memory.
+static quill_profile_counts_t *copy_counts(size_t *count) {
+    quill_profile_counts_t *counts = NULL;
+    size_t capacity = 0;
+    for(;;) {
+        quill_mutex_lock(&profile_lock);
+        if(bucket_c <= capacity) { break; }
+        size_t needed = bucket_c;
+        quill_mutex_unlock(&profile_lock);
+        // leaves room for buckets added until the lock is taken again
+        capacity = needed + needed / 4 + 16;
+        quill_profile_counts_t *grown
+            = realloc(counts, sizeof(quill_profile_counts_t) * capacity);
+        if(grown == NULL) {
+            free(counts);
+            return NULL;
+        }
+        counts = grown;
+    }
+    size_t count_i = 0;
+    for(size_t i = 0; i < BUCKET_TABLE_SIZE; i += 1) {
+        const quill_profile_bucket_t *bucket = buckets[i];
+        for(; bucket != NULL; bucket = bucket->next) {
+            counts[count_i] = (quill_profile_counts_t) {
+                .bucket = bucket,
+                .alloc_c = bucket->alloc_c, .alloc_size = bucket->alloc_size,
+                .free_c = bucket->free_c, .free_size = bucket->free_size
+            };
+            count_i += 1;
+        }
+    }
+    quill_mutex_unlock(&profile_lock);
+    *count = count_i;
+    return counts;
+}
+
+static void write_counts(
+    FILE *f, uint64_t inuse_c, uint64_t inuse_size,
+    uint64_t alloc_c, uint64_t alloc_size
+) {
+    fprintf(
+        f, "%llu: %llu [%llu: %llu] @",
+        (unsigned long long) inuse_c, (unsigned long long) inuse_size,
+        (unsigned long long) alloc_c, (unsigned long long) alloc_size
+    );
+}
+
+static void write_mappings(FILE *f) {
+    fprintf(f, "\nMAPPED_LIBRARIES:\n");
+    #ifndef _WIN32
+        FILE *maps = fopen("/proc/self/maps", "r");
+        if(maps == NULL) { return; }
+        char buffer[4096];
+        size_t read;
+        while((read = fread(buffer, 1, sizeof(buffer), maps)) > 0) {
+            fwrite(buffer, 1, read, f);
+        }
+        fclose(maps);
+    #endif
+}
+
+quill_bool_t quill_alloc_profile_dump(const char *path) {
+    size_t count_c = 0;
+    quill_profile_counts_t *counts = copy_counts(&count_c);
+    if(counts == NULL && count_c > 0) { return QUILL_FALSE; }
+    FILE *f = fopen(path, "w");
+    if(f == NULL) {
+        free(counts);
+        return QUILL_FALSE;
+    }
+    uint64_t total[4] = { 0, 0, 0, 0 };
+    for(size_t i = 0; i < count_c; i += 1) {
+        total[0] += counts[i].alloc_c - counts[i].free_c;
+        total[1] += counts[i].alloc_size - counts[i].free_size;
+        total[2] += counts[i].alloc_c;
+        total[3] += counts[i].alloc_size;
+    }
+    fprintf(f, "heap profile: ");
+    write_counts(f, total[0], total[1], total[2], total[3]);
+    fprintf(
+        f, " heap_v2/%zu\n",
+        atomic_load_explicit(&recorded_sample_size, memory_order_relaxed)
+    );
+    for(size_t i = 0; i < count_c; i += 1) {
+        const quill_profile_counts_t *c = &counts[i];
+        write_counts(
+            f, c->alloc_c - c->free_c, c->alloc_size - c->free_size,
+            c->alloc_c, c->alloc_size
+        );
+        for(size_t pc_i = 0; pc_i < c->bucket->depth; pc_i += 1) {
+            fprintf(
+                f, " 0x%016llx",
+                (unsigned long long) (uintptr_t) c->bucket->pcs[pc_i]
+            );
+        }
+        fprintf(f, "\n");
+    }
+    free(counts);
+    write_mappings(f);
+    return fclose(f) == 0;
+}
@@ -0,0 +1,521 @@
+#include <quill.h>
+#include <string.h>
+
+// number of destroyed allocations that are freed together
+#define FREE_BATCH_SIZE 64
+
+// Allocations waiting for their destructor to be run. Nothing references
+// them anymore, so their reference count is reused as the link.
+static thread_local quill_alloc_t *destroy_next = NULL;
+static thread_local quill_bool_t destroying = QUILL_FALSE;
+
+static void destroy_push(quill_alloc_t *alloc) {
+    atomic_store_explicit(
+        &alloc->rc, (uint64_t) (uintptr_t) destroy_next, memory_order_relaxed
+    );
+    destroy_next = alloc;
+}
+
+static quill_alloc_t *destroy_pop(void) {
+    quill_alloc_t *alloc = destroy_next;
+    destroy_next = (quill_alloc_t *) (uintptr_t) atomic_load_explicit(
+        &alloc->rc, memory_order_relaxed
+    );
+    return alloc;
+}
+
+void quill_rc_destroy(quill_alloc_t *alloc) {
+    destroy_push(alloc);
+    // called by a destructor - the loop below will get to it
+    if(destroying) { return; }
+    destroying = QUILL_TRUE;
+    void *freed[FREE_BATCH_SIZE];
+    size_t freed_c = 0;
+    while(destroy_next != NULL) {
+        quill_alloc_t *current = destroy_pop();
+        quill_destructor_t destructor = current->destructor;
+        if(destructor != NULL) { destructor(current); }
+        freed[freed_c] = current;
+        freed_c += 1;
+        if(freed_c == FREE_BATCH_SIZE) {
+            quill_alloc_free_batch(freed, freed_c);
+            freed_c = 0;
+        }
+    }
+    quill_alloc_free_batch(freed, freed_c);
+    destroying = QUILL_FALSE;
+}
+
+
+quill_unit_t quill_captured_noop_free(quill_alloc_t *alloc) {
+    (void) alloc;
+    return QUILL_UNIT;
+}
+
+quill_unit_t quill_captured_string_free(quill_alloc_t *alloc) {
+    quill_string_t *ref = (quill_string_t *) alloc->data;
+    quill_string_rc_dec(*ref);
+    return QUILL_UNIT;
+}
+
+quill_unit_t quill_captured_ref_free(quill_alloc_t *alloc) {
+    quill_alloc_t **ref = (quill_alloc_t **) alloc->data;
+    quill_rc_dec(*ref);
+    return QUILL_UNIT;
+}
+
+quill_unit_t quill_captured_closure_free(quill_alloc_t *alloc) {
+    quill_closure_t *ref = (quill_closure_t *) alloc->data;
+    quill_rc_dec(ref->alloc);
+    return QUILL_UNIT;
+}
+
+quill_unit_t quill_env_free(quill_alloc_t *alloc) {
+    const quill_env_layout_t *layout
+        = *((const quill_env_layout_t **) alloc->data);
+    uint8_t *slots = quill_env_slots(alloc);
+    for(size_t i = 0; i < layout->slot_c; i += 1) {
+        quill_slot_rc_dec(
+            layout->slots[i].kind, slots + layout->slots[i].offset
+        );
+    }
+    return QUILL_UNIT;
+}
+
+static void captured_string_traverse(
+    quill_alloc_t *alloc, quill_visit_t visit, void *context
+) {
+    quill_slot_visit(QUILL_ENV_SLOT_STRING, alloc->data, visit, context);
+}
+
+static void captured_ref_traverse(
+    quill_alloc_t *alloc, quill_visit_t visit, void *context
+) {
+    visit(*((quill_alloc_t **) alloc->data), context);
+}
+
+static void captured_closure_traverse(
+    quill_alloc_t *alloc, quill_visit_t visit, void *context
+) {
+    visit(((quill_closure_t *) alloc->data)->alloc, context);
+}
+
+static void env_traverse(
+    quill_alloc_t *alloc, quill_visit_t visit, void *context
+) {
+    const quill_env_layout_t *layout
+        = *((const quill_env_layout_t **) alloc->data);
+    uint8_t *slots = quill_env_slots(alloc);
+    for(size_t i = 0; i < layout->slot_c; i += 1) {
+        quill_slot_visit(
+            layout->slots[i].kind, slots + layout->slots[i].offset,
+            visit, context
+        );
+    }
+}
+
+
+#define TRAVERSE_REGISTRY_SIZE 1024
+
+typedef struct quill_traverse_entry {
+    _Atomic(quill_destructor_t) destructor;
+    _Atomic(quill_traverse_t) traverse;
+} quill_traverse_entry_t;
+
+static quill_traverse_entry_t traverse_registry[TRAVERSE_REGISTRY_SIZE];
+
+static size_t traverse_slot(quill_destructor_t destructor) {
+    uint64_t h = (uint64_t) (uintptr_t) destructor * 0x9E3779B97F4A7C15ULL;
+    return (size_t) (h >> 32) & (TRAVERSE_REGISTRY_SIZE - 1);
+}
+
+void quill_rc_register_traverse(
+    quill_destructor_t destructor, quill_traverse_t traverse
+) {
+    size_t i = traverse_slot(destructor);
+    for(size_t probe_c = 0; probe_c < TRAVERSE_REGISTRY_SIZE; probe_c += 1) {
+        quill_traverse_entry_t *entry = &traverse_registry[i];
+        quill_destructor_t found = NULL;
+        if(atomic_compare_exchange_strong_explicit(
+            &entry->destructor, &found, destructor,
+            memory_order_acq_rel, memory_order_acquire
+        ) || found == destructor) {
+            atomic_store_explicit(
+                &entry->traverse, traverse, memory_order_release
+            );
+            return;
+        }
+        i = (i + 1) & (TRAVERSE_REGISTRY_SIZE - 1);
+    }
+    quill_panic(quill_string_from_static_cstr(
+        "Too many traversal hooks registered\n"
+    ));
+}
+
+// Allocations without a hook are treated as having no references, which
+// may keep cycles through them alive, but never frees anything reachable.
+static quill_traverse_t traverse_of(quill_destructor_t destructor) {
+    if(destructor == &quill_captured_string_free) {
+        return &captured_string_traverse;
+    }
+    if(destructor == &quill_captured_ref_free) {
+        return &captured_ref_traverse;
+    }
+    if(destructor == &quill_captured_closure_free) {
+        return &captured_closure_traverse;
+    }
+    if(destructor == &quill_env_free) { return &env_traverse; }
+    if(destructor == &quill_rope_free) { return &quill_rope_traverse; }
+    size_t i = traverse_slot(destructor);
+    for(size_t probe_c = 0; probe_c < TRAVERSE_REGISTRY_SIZE; probe_c += 1) {
+        quill_traverse_entry_t *entry = &traverse_registry[i];
+        quill_destructor_t found
+            = atomic_load_explicit(&entry->destructor, memory_order_acquire);
+        if(found == NULL) { return NULL; }
+        if(found == destructor) {
+            return atomic_load_explicit(
+                &entry->traverse, memory_order_acquire
+            );
+        }
+        i = (i + 1) & (TRAVERSE_REGISTRY_SIZE - 1);
+    }
+    return NULL;
+}
+
+
+// Synchronous trial deletion (Bacon and Rajan, "Concurrent Cycle Collection
+// in Reference Counted Systems"). Allocations that get decremented to a
+// non-zero count are buffered as possible roots of garbage cycles. A
+// collection subtracts the references internal to the subgraph reachable
+// from the roots (gray), restores the counts of everything still referenced
+// from outside (black) and frees what is left (white).
+
+#define COLOR_BLACK ((uint64_t) 0 << 59)
+#define COLOR_GRAY ((uint64_t) 1 << 59)
+#define COLOR_WHITE ((uint64_t) 2 << 59)
+
+#define DEFAULT_ROOT_THRESHOLD 8192
+#define DEFAULT_SLICE_ROOT_C 1024
+
+typedef struct quill_alloc_stack {
+    quill_alloc_t **items;
+    size_t count;
+    size_t capacity;
+} quill_alloc_stack_t;
+
+typedef struct quill_collector {
+    quill_alloc_stack_t roots;
+    quill_alloc_stack_t candidates;
+    quill_alloc_stack_t work;
+    quill_alloc_stack_t black_work;
+    quill_alloc_stack_t garbage;
+    // buffered roots whose count reached zero
+    quill_alloc_stack_t dead;
+    quill_bool_t collecting;
+} quill_collector_t;
+
+static _Atomic(size_t) root_threshold = DEFAULT_ROOT_THRESHOLD;
+static _Atomic(size_t) slice_root_c = DEFAULT_SLICE_ROOT_C;
+
+static thread_local quill_collector_t thread_collector;
+
+static void alloc_stack_push(quill_alloc_stack_t *stack, quill_alloc_t *a) {
+    if(stack->count == stack->capacity) {
+        size_t capacity = stack->capacity == 0 ? 64 : stack->capacity * 2;
+        quill_alloc_t **items = realloc(
+            stack->items, sizeof(quill_alloc_t *) * capacity
+        );
+        if(items == NULL) {
+            quill_panic(quill_string_from_static_cstr(
+                "Unable to allocate memory\n"
+            ));
+        }
+        stack->items = items;
+        stack->capacity = capacity;
+    }
+    stack->items[stack->count] = a;
+    stack->count += 1;
+}
+
+static quill_alloc_t *alloc_stack_pop(quill_alloc_stack_t *stack) {
+    if(stack->count == 0) { return NULL; }
+    stack->count -= 1;
+    return stack->items[stack->count];
+}
+
+static void alloc_stack_free(quill_alloc_stack_t *stack) {
+    free(stack->items);
+    stack->items = NULL;
+    stack->count = 0;
+    stack->capacity = 0;
+}
+
+static uint64_t rc_of(quill_alloc_t *alloc) {
+    return atomic_load_explicit(&alloc->rc, memory_order_relaxed);
+}
+
+static void set_rc(quill_alloc_t *alloc, uint64_t rc) {
+    atomic_store_explicit(&alloc->rc, rc, memory_order_relaxed);
+}
+
+static void set_color(quill_alloc_t *alloc, uint64_t color) {
+    set_rc(alloc, (rc_of(alloc) & ~QUILL_RC_COLOR_MASK) | color);
+}
+
+// Only allocations for which this holds can be part of collected cycles.
+static quill_bool_t is_traced(quill_alloc_t *alloc) {
+    if(alloc == NULL || alloc->destructor == NULL) { return QUILL_FALSE; }
+    uint64_t rc = rc_of(alloc);
+    return (rc & (QUILL_RC_IMMORTAL | QUILL_RC_SHARED)) == 0;
+}
+
+static void traverse_children(
+    quill_alloc_t *alloc, quill_visit_t visit, quill_collector_t *c
+) {
+    quill_traverse_t traverse = traverse_of(alloc->destructor);
+    if(traverse != NULL) { traverse(alloc, visit, c); }
+}
+
+static void visit_mark_gray(quill_alloc_t *child, void *context) {
+    if(!is_traced(child)) { return; }
+    quill_collector_t *c = (quill_collector_t *) context;
+    uint64_t rc = rc_of(child) - 1;
+    if((rc & QUILL_RC_COLOR_MASK) != COLOR_GRAY) {
+        rc = (rc & ~QUILL_RC_COLOR_MASK) | COLOR_GRAY;
+        alloc_stack_push(&c->work, child);
+    }
+    set_rc(child, rc);
+}
+
+static void mark_gray(quill_collector_t *c, quill_alloc_t *root) {
+    if((rc_of(root) & QUILL_RC_COLOR_MASK) == COLOR_GRAY) { return; }
+    set_color(root, COLOR_GRAY);
+    alloc_stack_push(&c->work, root);
+    quill_alloc_t *current;
+    while((current = alloc_stack_pop(&c->work)) != NULL) {
+        traverse_children(current, &visit_mark_gray, c);
+    }
+}
+
+static void visit_scan_black(quill_alloc_t *child, void *context) {
+    if(!is_traced(child)) { return; }
+    quill_collector_t *c = (quill_collector_t *) context;
+    uint64_t rc = rc_of(child) + 1;
+    if((rc & QUILL_RC_COLOR_MASK) != COLOR_BLACK) {
+        rc = (rc & ~QUILL_RC_COLOR_MASK) | COLOR_BLACK;
+        alloc_stack_push(&c->black_work, child);
+    }
+    set_rc(child, rc);
+}
+
+static void scan_black(quill_collector_t *c, quill_alloc_t *alloc) {
+    set_color(alloc, COLOR_BLACK);
+    alloc_stack_push(&c->black_work, alloc);
+    quill_alloc_t *current;
+    while((current = alloc_stack_pop(&c->black_work)) != NULL) {
+        traverse_children(current, &visit_scan_black, c);
+    }
+}
+
+static void visit_push(quill_alloc_t *child, void *context) {
+    if(!is_traced(child)) { return; }
+    alloc_stack_push(&((quill_collector_t *) context)->work, child);
+}
+
+static void scan(quill_collector_t *c, quill_alloc_t *root) {
+    alloc_stack_push(&c->work, root);
+    quill_alloc_t *current;
+    while((current = alloc_stack_pop(&c->work)) != NULL) {
+        uint64_t rc = rc_of(current);
+        if((rc & QUILL_RC_COLOR_MASK) != COLOR_GRAY) { continue; }
+        if((rc & QUILL_RC_COUNT_MASK) > 0) {
+            scan_black(c, current);
+            continue;
+        }
+        set_color(current, COLOR_WHITE);
+        traverse_children(current, &visit_push, c);
+    }
+}
+
+// Garbage is made immortal so that the destructors of other garbage don't
+// touch it. Garbage that is still in the roots is freed from there.
+static void mark_garbage(quill_collector_t *c, quill_alloc_t *alloc) {
+    uint64_t rc = rc_of(alloc);
+    set_rc(alloc, QUILL_RC_IMMORTAL | (rc & QUILL_RC_BUFFERED));
+    alloc_stack_push(&c->garbage, alloc);
+    alloc_stack_push(&c->work, alloc);
+}
+
+static void visit_collect_white(quill_alloc_t *child, void *context) {
+    if(!is_traced(child)) { return; }
+    if((rc_of(child) & QUILL_RC_COLOR_MASK) != COLOR_WHITE) { return; }
+    mark_garbage((quill_collector_t *) context, child);
+}
+
+static void collect_white(quill_collector_t *c, quill_alloc_t *root) {
+    if((rc_of(root) & QUILL_RC_COLOR_MASK) != COLOR_WHITE) { return; }
+    mark_garbage(c, root);
+    quill_alloc_t *current;
+    while((current = alloc_stack_pop(&c->work)) != NULL) {
+        traverse_children(current, &visit_collect_white, c);
+    }
+}
+
+// References from garbage to the rest were subtracted by 'mark_gray', but
+// will be released again by the destructors of the garbage.
+static void visit_restore(quill_alloc_t *child, void *context) {
+    (void) context;
+    if(!is_traced(child)) { return; }
+    set_rc(child, rc_of(child) + 1);
+}
+
+static void take_candidates(quill_collector_t *c, size_t max_root_c) {
+    size_t n = c->roots.count < max_root_c ? c->roots.count : max_root_c;
+    c->candidates.count = 0;
+    // the oldest roots are checked first
+    for(size_t i = 0; i < n; i += 1) {
+        quill_alloc_t *root = c->roots.items[i];
+        uint64_t rc = rc_of(root);
+        if((rc & QUILL_RC_IMMORTAL) != 0) {
+            // collected as part of a cycle while buffered
+            quill_alloc_free(root);
+        } else if((rc & QUILL_RC_SHARED) != 0) {
+            // the flag is the only thing other threads let us change
+            rc = atomic_fetch_and_explicit(
+                &root->rc, ~QUILL_RC_BUFFERED, memory_order_acq_rel
+            );
+            if((rc & QUILL_RC_COUNT_MASK) == 0) {
+                alloc_stack_push(&c->dead, root);
+            }
+        } else if((rc & QUILL_RC_COUNT_MASK) == 0) {
+            set_rc(root, rc & ~QUILL_RC_BUFFERED);
+            alloc_stack_push(&c->dead, root);
+        } else {
+            alloc_stack_push(&c->candidates, root);
+        }
+    }
+    memmove(
+        c->roots.items, c->roots.items + n,
+        sizeof(quill_alloc_t *) * (c->roots.count - n)
+    );
+    c->roots.count -= n;
+}
+
+size_t quill_rc_collect_cycles(size_t max_root_c) {
+    quill_collector_t *c = &thread_collector;
+    if(c->collecting) { return 0; }
+    c->collecting = QUILL_TRUE;
+    take_candidates(c, max_root_c);
+    quill_alloc_stack_t *candidates = &c->candidates;
+    for(size_t i = 0; i < candidates->count; i += 1) {
+        mark_gray(c, candidates->items[i]);
+    }
+    for(size_t i = 0; i < candidates->count; i += 1) {
+        scan(c, candidates->items[i]);
+    }
+    for(size_t i = 0; i < candidates->count; i += 1) {
+        quill_alloc_t *root = candidates->items[i];
+        set_rc(root, rc_of(root) & ~QUILL_RC_BUFFERED);
+    }
+    for(size_t i = 0; i < candidates->count; i += 1) {
+        collect_white(c, candidates->items[i]);
+    }
+    candidates->count = 0;
+    // releases the references from garbage to allocations outside of it
+    quill_alloc_stack_t *garbage = &c->garbage;
+    for(size_t i = 0; i < garbage->count; i += 1) {
+        traverse_children(garbage->items[i], &visit_restore, c);
+    }
+    for(size_t i = 0; i < garbage->count; i += 1) {
+        quill_alloc_t *alloc = garbage->items[i];
+        alloc->destructor(alloc);
+    }
+    size_t freed_c = garbage->count;
+    size_t unbuffered_c = 0;
+    for(size_t i = 0; i < garbage->count; i += 1) {
+        quill_alloc_t *alloc = garbage->items[i];
+        if(rc_of(alloc) != QUILL_RC_IMMORTAL) { continue; }
+        garbage->items[unbuffered_c] = alloc;
+        unbuffered_c += 1;
+    }
+    quill_alloc_free_batch((void **) garbage->items, unbuffered_c);
+    garbage->count = 0;
+    quill_alloc_t *dead;
+    while((dead = alloc_stack_pop(&c->dead)) != NULL) {
+        quill_rc_destroy(dead);
+        freed_c += 1;
+    }
+    c->collecting = QUILL_FALSE;
+    return freed_c;
+}
+
+void quill_rc_buffer(quill_alloc_t *alloc) {
+    quill_collector_t *c = &thread_collector;
+    uint64_t rc = rc_of(alloc);
+    // shared allocations may be freed by other threads at any time
+    if((rc & (QUILL_RC_IMMORTAL | QUILL_RC_SHARED | QUILL_RC_BUFFERED)) != 0) {
+        return;
+    }
+    set_rc(alloc, rc | QUILL_RC_BUFFERED);
+    alloc_stack_push(&c->roots, alloc);
+    size_t threshold
+        = atomic_load_explicit(&root_threshold, memory_order_relaxed);
+    if(threshold == 0 || c->roots.count < threshold) { return; }
+    // the graph is not consistent while destructors are running
+    if(destroying || c->collecting) { return; }
+    quill_rc_collect_cycles(
+        atomic_load_explicit(&slice_root_c, memory_order_relaxed)
+    );
+}
+
+void quill_rc_set_cycle_collection(
+    size_t new_root_threshold, size_t new_slice_root_c
+) {
+    atomic_store_explicit(
+        &root_threshold, new_root_threshold, memory_order_relaxed
+    );
+    atomic_store_explicit(
+        &slice_root_c, new_slice_root_c, memory_order_relaxed
+    );
+}
+
+
+// Everything reachable from a shared allocation is shared as well, which
+// is why allocations that already are don't need to be traversed.
+static thread_local quill_alloc_stack_t share_work;
+
+static void visit_share(quill_alloc_t *child, void *context) {
+    if(child == NULL) { return; }
+    uint64_t rc = rc_of(child);
+    if((rc & (QUILL_RC_IMMORTAL | QUILL_RC_SHARED)) != 0) { return; }
+    atomic_store_explicit(
+        &child->rc, rc | QUILL_RC_SHARED, memory_order_release
+    );
+    alloc_stack_push((quill_alloc_stack_t *) context, child);
+}
+
+void quill_rc_share(quill_alloc_t *alloc) {
+    quill_alloc_stack_t *work = &share_work;
+    visit_share(alloc, work);
+    quill_alloc_t *current;
+    while((current = alloc_stack_pop(work)) != NULL) {
+        if(current->destructor == NULL) { continue; }
+        quill_traverse_t traverse = traverse_of(current->destructor);
+        if(traverse != NULL) { traverse(current, &visit_share, work); }
+    }
+}
+
+void quill_rc_destruct_thread(void) {
+    quill_collector_t *c = &thread_collector;
+    // destructors of collected garbage may buffer new roots
+    while(c->roots.count > 0) {
+        quill_rc_collect_cycles(SIZE_MAX);
+    }
+    alloc_stack_free(&c->roots);
+    alloc_stack_free(&c->candidates);
+    alloc_stack_free(&c->work);
+    alloc_stack_free(&c->black_work);
+    alloc_stack_free(&c->garbage);
+    alloc_stack_free(&c->dead);
+    alloc_stack_free(&share_work);
+}
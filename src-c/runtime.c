@@ -14,6 +14,8 @@ static void quill_runtime_init_args(int argc, char **argv) {
     for(size_t i = 0; i < argc; i += 1) {
         args_data[i] = quill_string_from_static_cstr(argv[i]);
     }
+    // readable from all threads
+    quill_rc_share(quill_program_args);
 }
 
 void quill_runtime_init_global(int argc, char **argv) {
@@ -37,6 +39,8 @@ void quill_runtime_init_dyn(quill_list_t args) {
 }
 
 void quill_runtime_destruct_dyn(void *unused_allocs) {
+    quill_flush_destruct_thread();
+    quill_rc_destruct_thread();
     quill_alloc_migrate_to(unused_allocs);
     quill_alloc_destruct_global();
 }
@@ -46,5 +50,7 @@ void quill_runtime_init_thread(void) {
 }
 
 void quill_runtime_destruct_thread(void) {
+    quill_flush_destruct_thread();
+    quill_rc_destruct_thread();
     quill_alloc_migrate_to(quill_alloc_get_unused());
 }
@@ -0,0 +1,402 @@
+#include <quill.h>
+
+#ifdef _WIN32
+    #define YIELD_THREAD() SwitchToThread()
+#else
+    #include <sched.h>
+    #include <unistd.h>
+    #define YIELD_THREAD() sched_yield()
+#endif
+
+struct quill_task {
+    quill_closure_t closure;
+    // next task in the queue of injected tasks
+    struct quill_task *next;
+    quill_event_t done;
+};
+
+// Chase-Lev deque - the owning worker pushes and takes at the bottom,
+// other threads steal from the top. Once full, the slots are copied into
+// an array of twice the size. Thieves may still be reading the previous
+// array, which is kept around since workers (and with them their deques)
+// are never destructed.
+#define MIN_DEQUE_CAPACITY 1024
+#define CACHE_LINE_SIZE 64
+
+typedef struct quill_deque_array {
+    struct quill_deque_array *previous;
+    int64_t capacity;
+    _Atomic(quill_task_t *) slots[];
+} quill_deque_array_t;
+
+typedef struct quill_deque {
+    _Atomic(int64_t) top;
+    uint8_t top_padding[CACHE_LINE_SIZE - sizeof(int64_t)];
+    _Atomic(int64_t) bottom;
+    uint8_t bottom_padding[CACHE_LINE_SIZE - sizeof(int64_t)];
+    _Atomic(quill_deque_array_t *) array;
+} quill_deque_t;
+
+static quill_deque_array_t *deque_array_alloc(int64_t capacity) {
+    quill_deque_array_t *array = malloc(
+        sizeof(quill_deque_array_t)
+            + sizeof(_Atomic(quill_task_t *)) * (size_t) capacity
+    );
+    if(array == NULL) {
+        quill_panic(quill_string_from_static_cstr(
+            "Unable to allocate memory\n"
+        ));
+    }
+    array->previous = NULL;
+    array->capacity = capacity;
+    return array;
+}
+
+static _Atomic(quill_task_t *) *deque_slot(
+    quill_deque_array_t *array, int64_t i
+) {
+    return &array->slots[i & (array->capacity - 1)];
+}
+
+static quill_deque_array_t *deque_grow(
+    quill_deque_t *deque, quill_deque_array_t *array,
+    int64_t top, int64_t bottom
+) {
+    quill_deque_array_t *grown = deque_array_alloc(array->capacity * 2);
+    for(int64_t i = top; i < bottom; i += 1) {
+        quill_task_t *task = atomic_load_explicit(
+            deque_slot(array, i), memory_order_relaxed
+        );
+        atomic_store_explicit(deque_slot(grown, i), task, memory_order_relaxed);
+    }
+    grown->previous = array;
+    atomic_store_explicit(&deque->array, grown, memory_order_release);
+    return grown;
+}
+
+static void deque_push(quill_deque_t *deque, quill_task_t *task) {
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    quill_deque_array_t *array
+        = atomic_load_explicit(&deque->array, memory_order_relaxed);
+    if(bottom - top >= array->capacity) {
+        array = deque_grow(deque, array, top, bottom);
+    }
+    atomic_store_explicit(
+        deque_slot(array, bottom), task, memory_order_relaxed
+    );
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_release);
+}
+
+static quill_task_t *deque_take(quill_deque_t *deque) {
+    int64_t bottom
+        = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+    if(top > bottom) {
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+        return NULL;
+    }
+    quill_deque_array_t *array
+        = atomic_load_explicit(&deque->array, memory_order_relaxed);
+    quill_task_t *task = atomic_load_explicit(
+        deque_slot(array, bottom), memory_order_relaxed
+    );
+    if(top == bottom) {
+        // the last task, which a thief may be taking at the same time
+        if(!atomic_compare_exchange_strong_explicit(
+            &deque->top, &top, top + 1,
+            memory_order_seq_cst, memory_order_relaxed
+        )) {
+            task = NULL;
+        }
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    }
+    return task;
+}
+
+static quill_task_t *deque_steal(quill_deque_t *deque) {
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+    if(top >= bottom) { return NULL; }
+    // a previous array still holds the task if the deque grew since
+    quill_deque_array_t *array
+        = atomic_load_explicit(&deque->array, memory_order_acquire);
+    quill_task_t *task = atomic_load_explicit(
+        deque_slot(array, top), memory_order_relaxed
+    );
+    if(!atomic_compare_exchange_strong_explicit(
+        &deque->top, &top, top + 1,
+        memory_order_seq_cst, memory_order_relaxed
+    )) {
+        return NULL;
+    }
+    return task;
+}
+
+typedef struct quill_worker {
+    quill_deque_t deque;
+    uint64_t random;
+} quill_worker_t;
+
+typedef struct quill_pool {
+    quill_worker_t *workers;
+    size_t worker_c;
+    // tasks spawned by threads that aren't workers
+    quill_mutex_t injected_lock;
+    quill_task_t *injected_first;
+    quill_task_t *injected_last;
+    _Atomic(size_t) injected_c;
+    // idle workers wait for the epoch to change
+    quill_mutex_t park_lock;
+    quill_cond_t park_cond;
+    _Atomic(uint32_t) park_epoch;
+    _Atomic(size_t) parked_c;
+} quill_pool_t;
+
+static quill_pool_t pool;
+static _Atomic(quill_bool_t) pool_started = QUILL_FALSE;
+static atomic_flag starting_pool = ATOMIC_FLAG_INIT;
+
+static thread_local quill_worker_t *current_worker = NULL;
+
+static void inject(quill_task_t *task) {
+    task->next = NULL;
+    quill_mutex_lock(&pool.injected_lock);
+    if(pool.injected_last == NULL) {
+        pool.injected_first = task;
+    } else {
+        pool.injected_last->next = task;
+    }
+    pool.injected_last = task;
+    atomic_fetch_add_explicit(&pool.injected_c, 1, memory_order_seq_cst);
+    quill_mutex_unlock(&pool.injected_lock);
+}
+
+static quill_task_t *take_injected(void) {
+    if(atomic_load_explicit(&pool.injected_c, memory_order_seq_cst) == 0) {
+        return NULL;
+    }
+    quill_mutex_lock(&pool.injected_lock);
+    quill_task_t *task = pool.injected_first;
+    if(task != NULL) {
+        pool.injected_first = task->next;
+        if(pool.injected_first == NULL) { pool.injected_last = NULL; }
+        atomic_fetch_sub_explicit(&pool.injected_c, 1, memory_order_relaxed);
+    }
+    quill_mutex_unlock(&pool.injected_lock);
+    return task;
+}
+
+static size_t random_worker_i(quill_worker_t *worker) {
+    static _Atomic(uint64_t) shared_random = 0x9E3779B97F4A7C15ULL;
+    uint64_t x;
+    if(worker != NULL) {
+        x = worker->random;
+    } else {
+        x = atomic_fetch_add_explicit(
+            &shared_random, 0x9E3779B97F4A7C15ULL, memory_order_relaxed
+        );
+    }
+    // xorshift64
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    if(worker != NULL) { worker->random = x; }
+    return (size_t) (x % pool.worker_c);
+}
+
+// 'worker' is NULL for threads that aren't part of the pool.
+static quill_task_t *find_task(quill_worker_t *worker) {
+    if(worker != NULL) {
+        quill_task_t *task = deque_take(&worker->deque);
+        if(task != NULL) { return task; }
+    }
+    quill_task_t *task = take_injected();
+    if(task != NULL) { return task; }
+    size_t start = random_worker_i(worker);
+    for(size_t i = 0; i < pool.worker_c; i += 1) {
+        quill_worker_t *victim = &pool.workers[(start + i) % pool.worker_c];
+        if(victim == worker) { continue; }
+        task = deque_steal(&victim->deque);
+        if(task != NULL) { return task; }
+    }
+    return NULL;
+}
+
+static void run_task(quill_task_t *task) {
+    quill_closure_t closure = task->closure;
+    QUILL_CALL_CLOSURE_NA(closure, QUILL_CLOSURE_FPTR_NA(closure, quill_unit_t));
+    quill_closure_rc_dec(closure);
+    // workers are never destructed, so their output is written right away
+    if(current_worker != NULL) { quill_flush(); }
+    quill_event_set(&task->done);
+}
+
+static void wake_worker(void) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if(atomic_load_explicit(&pool.parked_c, memory_order_relaxed) == 0) {
+        return;
+    }
+    quill_mutex_lock(&pool.park_lock);
+    atomic_fetch_add_explicit(&pool.park_epoch, 1, memory_order_relaxed);
+    quill_cond_signal(&pool.park_cond);
+    quill_mutex_unlock(&pool.park_lock);
+}
+
+// number of failed attempts to find a task before an idle worker parks
+#define IDLE_SPIN_C 64
+
+static void run_worker(quill_worker_t *worker) {
+    current_worker = worker;
+    quill_runtime_init_thread();
+    size_t idle_c = 0;
+    for(;;) {
+        quill_task_t *task = find_task(worker);
+        if(task != NULL) {
+            run_task(task);
+            idle_c = 0;
+            continue;
+        }
+        idle_c += 1;
+        if(idle_c < IDLE_SPIN_C) {
+            YIELD_THREAD();
+            continue;
+        }
+        uint32_t epoch
+            = atomic_load_explicit(&pool.park_epoch, memory_order_relaxed);
+        atomic_fetch_add_explicit(&pool.parked_c, 1, memory_order_seq_cst);
+        // tasks spawned before the count was increased may not wake us
+        task = find_task(worker);
+        if(task == NULL) {
+            quill_mutex_lock(&pool.park_lock);
+            while(atomic_load_explicit(
+                &pool.park_epoch, memory_order_relaxed
+            ) == epoch) {
+                quill_cond_wait(&pool.park_cond, &pool.park_lock);
+            }
+            quill_mutex_unlock(&pool.park_lock);
+        }
+        atomic_fetch_sub_explicit(&pool.parked_c, 1, memory_order_relaxed);
+        if(task != NULL) { run_task(task); }
+        idle_c = 0;
+    }
+}
+
+#ifdef _WIN32
+    static DWORD WINAPI worker_main(LPVOID worker) {
+        run_worker((quill_worker_t *) worker);
+        return 0;
+    }
+
+    static quill_bool_t start_worker(quill_worker_t *worker) {
+        HANDLE thread = CreateThread(NULL, 0, &worker_main, worker, 0, NULL);
+        if(thread == NULL) { return QUILL_FALSE; }
+        CloseHandle(thread);
+        return QUILL_TRUE;
+    }
+
+    static size_t core_count(void) {
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        return (size_t) info.dwNumberOfProcessors;
+    }
+#else
+    static void *worker_main(void *worker) {
+        run_worker((quill_worker_t *) worker);
+        return NULL;
+    }
+
+    static quill_bool_t start_worker(quill_worker_t *worker) {
+        pthread_t thread;
+        if(pthread_create(&thread, NULL, &worker_main, worker) != 0) {
+            return QUILL_FALSE;
+        }
+        pthread_detach(thread);
+        return QUILL_TRUE;
+    }
+
+    static size_t core_count(void) {
+        long count = sysconf(_SC_NPROCESSORS_ONLN);
+        return count < 1 ? 1 : (size_t) count;
+    }
+#endif
+
+void quill_sched_init(size_t worker_c) {
+    if(atomic_load_explicit(&pool_started, memory_order_acquire)) { return; }
+    while(atomic_flag_test_and_set_explicit(
+        &starting_pool, memory_order_acquire
+    )) {}
+    if(!atomic_load_explicit(&pool_started, memory_order_relaxed)) {
+        if(worker_c == 0) { worker_c = core_count(); }
+        // the deques need to be zeroed
+        pool.workers = calloc(worker_c, sizeof(quill_worker_t));
+        if(pool.workers == NULL) {
+            quill_panic(quill_string_from_static_cstr(
+                "Unable to allocate memory\n"
+            ));
+        }
+        pool.worker_c = worker_c;
+        quill_mutex_init(&pool.injected_lock);
+        quill_mutex_init(&pool.park_lock);
+        quill_cond_init(&pool.park_cond);
+        for(size_t i = 0; i < worker_c; i += 1) {
+            atomic_store_explicit(
+                &pool.workers[i].deque.array,
+                deque_array_alloc(MIN_DEQUE_CAPACITY), memory_order_relaxed
+            );
+            pool.workers[i].random = 0x9E3779B97F4A7C15ULL * (i + 1);
+            if(!start_worker(&pool.workers[i])) {
+                quill_panic(quill_string_from_static_cstr(
+                    "Unable to start worker thread\n"
+                ));
+            }
+        }
+        atomic_store_explicit(&pool_started, QUILL_TRUE, memory_order_release);
+    }
+    atomic_flag_clear_explicit(&starting_pool, memory_order_release);
+}
+
+quill_task_t *quill_task_spawn(quill_closure_t closure) {
+    quill_sched_init(0);
+    quill_task_t *task = quill_alloc_alloc(sizeof(quill_task_t));
+    if(task == NULL) {
+        quill_panic(quill_string_from_static_cstr(
+            "Unable to allocate memory\n"
+        ));
+    }
+    // the closure and everything it references may now be used (and
+    // released) by another thread
+    quill_rc_share(closure.alloc);
+    task->closure = closure;
+    task->next = NULL;
+    quill_event_init(&task->done);
+    quill_worker_t *worker = current_worker;
+    if(worker == NULL) {
+        inject(task);
+    } else {
+        deque_push(&worker->deque, task);
+    }
+    wake_worker();
+    return task;
+}
+
+void quill_task_join(quill_task_t *task) {
+    // runs other tasks until there are none left to find for a while,
+    // at which point the task is running somewhere else
+    size_t idle_c = 0;
+    while(idle_c < IDLE_SPIN_C && !quill_event_is_set(&task->done)) {
+        quill_task_t *other = find_task(current_worker);
+        if(other != NULL) {
+            run_task(other);
+            idle_c = 0;
+            continue;
+        }
+        idle_c += 1;
+        YIELD_THREAD();
+    }
+    quill_event_wait(&task->done);
+    quill_alloc_free(task);
+}
@@ -1,13 +1,7 @@
 
 #include <quill.h>
-#include <stdio.h>
-#include <inttypes.h>
 #include <string.h>
 
-#define PRIqd PRId64 // quill_int_t
-#define PRIqu PRIu64 // quill_uint_t
-#define PRIqf "f"   // quill_float_t
-
 quill_int_t quill_point_encode_length(uint32_t point) {
     if(point <= 0x00007F) { return 1; }
     if(point <= 0x0007FF) { return 2; }
@@ -94,110 +88,562 @@ uint32_t quill_point_decode(const uint8_t *data) {
     return 0;
 }
 
+// Only strings at least this long get an index.
+#define MIN_INDEXED_LENGTH 256
+#define POINTS_PER_INDEX_ENTRY 64
+
+#define INDEX_EMPTY 0
+#define INDEX_BUILDING 1
+#define INDEX_BUILT 2
+
+static size_t index_entry_c(
+    quill_int_t length_bytes, quill_int_t length_points
+) {
+    if(length_points == length_bytes) { return 0; }
+    if(length_bytes < MIN_INDEXED_LENGTH) { return 0; }
+    // offsets are stored as 32 bit integers
+    if((uint64_t) length_bytes > UINT32_MAX) { return 0; }
+    return (size_t) length_points / POINTS_PER_INDEX_ENTRY;
+}
+
+static size_t index_start(quill_int_t length_bytes) {
+    return ((size_t) length_bytes + 3) & ~(size_t) 3;
+}
+
+size_t quill_string_index_size(
+    quill_int_t length_bytes, quill_int_t length_points
+) {
+    size_t entry_c = index_entry_c(length_bytes, length_points);
+    if(entry_c == 0) { return 0; }
+    return index_start(length_bytes) - (size_t) length_bytes
+        + sizeof(uint32_t) * entry_c;
+}
+
+void quill_string_init_header(
+    quill_alloc_t *alloc, quill_int_t length_bytes, quill_int_t length_points
+) {
+    // set before the allocation is reachable from anywhere else
+    uint64_t rc = atomic_load_explicit(&alloc->rc, memory_order_relaxed);
+    atomic_store_explicit(
+        &alloc->rc, rc | QUILL_RC_STRING_HEADER, memory_order_relaxed
+    );
+    quill_string_header_t *header = (quill_string_header_t *) alloc->data;
+    header->length_bytes = (uint64_t) length_bytes;
+    atomic_store_explicit(&header->hash, 0, memory_order_relaxed);
+    header->index_entry_c
+        = (uint32_t) index_entry_c(length_bytes, length_points);
+    atomic_store_explicit(
+        &header->index_state, INDEX_EMPTY, memory_order_relaxed
+    );
+}
+
+static quill_alloc_t *string_alloc(
+    quill_int_t length_bytes, quill_int_t length_points
+) {
+    quill_alloc_t *alloc = quill_malloc(
+        sizeof(quill_string_header_t) + sizeof(uint8_t) * length_bytes
+            + quill_string_index_size(length_bytes, length_points),
+        NULL
+    );
+    quill_string_init_header(alloc, length_bytes, length_points);
+    return alloc;
+}
+
+// Sets up 's' to hold 'length_bytes' bytes and returns where they need to
+// be written to, which is inside of 's' itself for short strings.
+static uint8_t *string_init(
+    quill_string_t *s, quill_int_t length_bytes, quill_int_t length_points
+) {
+    s->length_bytes = length_bytes;
+    s->length_points = length_points;
+    if(quill_string_is_inline(*s)) {
+        memset(s->inline_data, 0, QUILL_STRING_INLINE_MAX);
+        return s->inline_data;
+    }
+    s->alloc = string_alloc(length_bytes, length_points);
+    s->data = quill_string_alloc_bytes(s->alloc);
+    return quill_string_alloc_bytes(s->alloc);
+}
+
 quill_string_t quill_string_from_points(
     uint32_t *points, quill_int_t length_points
 ) {
-    quill_int_t length_bytes = 0;
-    for(quill_int_t i = 0; i < length_points; i += 1) {
-        length_bytes += quill_point_encode_length(points[i]);
+    quill_int_t length_bytes
+        = quill_utf8_length_of_points(points, length_points);
+    if(length_bytes < 0) {
+        // panics with the reason the point can't be encoded
+        for(quill_int_t i = 0; i < length_points; i += 1) {
+            quill_point_encode_length(points[i]);
+        }
     }
-    quill_alloc_t *alloc = quill_malloc(sizeof(uint8_t) * length_bytes, NULL);
-    uint8_t *data = (uint8_t *) alloc->data;
-    quill_int_t offset = 0;
-    for(quill_int_t i = 0; i < length_points; i += 1) {
-        offset += quill_point_encode(points[i], data + offset);
+    quill_string_t res;
+    uint8_t *data = string_init(&res, length_bytes, length_points);
+    quill_utf8_encode(points, length_points, data, length_bytes);
+    return res;
+}
+
+static quill_int_t validated_length_points(
+    const uint8_t *data, size_t length_bytes
+) {
+    quill_int_t length_points = quill_utf8_validate(data, length_bytes);
+    if(length_points < 0) {
+        quill_panic(quill_string_from_static_cstr(
+            "String improperly encoded\n"
+        ));
     }
-    return (quill_string_t) {
-        .alloc = alloc,
-        .data = data,
-        .length_bytes = length_bytes,
-        .length_points = length_points
-    };
+    return length_points;
 }
 
 quill_string_t quill_string_from_static_cstr(const char *cstr) {
-    uint8_t *data = (uint8_t *) cstr;
-    quill_int_t length_bytes = 0;
-    quill_int_t length_points = 0;
-    for(;;) {
-        uint8_t current = data[length_bytes];
-        if(current == '\0') { break; }
-        length_bytes += quill_point_decode_length(current);
-        length_points += 1;
-    }
-    return (quill_string_t) {
-        .alloc = NULL,
-        .data = data,
-        .length_bytes = length_bytes,
-        .length_points = length_points
-    };
+    const uint8_t *data = (const uint8_t *) cstr;
+    quill_int_t length_bytes = (quill_int_t) strlen(cstr);
+    quill_int_t length_points = validated_length_points(data, length_bytes);
+    quill_string_t res;
+    res.length_bytes = length_bytes;
+    res.length_points = length_points;
+    if(quill_string_is_inline(res)) {
+        string_init(&res, length_bytes, length_points);
+        memcpy(res.inline_data, data, length_bytes);
+        return res;
+    }
+    res.alloc = NULL;
+    res.data = data;
+    return res;
 }
 
-quill_string_t quill_string_from_temp_cstr(const char *cstr) {
-    uint8_t *data = (uint8_t *) cstr;
+quill_string_t quill_string_from_valid_utf8(
+    const uint8_t *data, quill_int_t length_bytes, quill_int_t length_points
+) {
     quill_string_t res;
-    res.length_bytes = 0;
-    res.length_points = 0;
-    for(;;) {
-        uint8_t current = data[res.length_bytes];
-        if(current == '\0') { break; }
-        res.length_bytes += quill_point_decode_length(current);
-        res.length_points += 1;
-    }
-    res.alloc = quill_malloc(sizeof(uint8_t) * res.length_bytes, NULL);
-    res.data = res.alloc->data;
-    memcpy(res.alloc->data, data, sizeof(uint8_t) * res.length_bytes);
+    uint8_t *dest = string_init(&res, length_bytes, length_points);
+    memcpy(dest, data, sizeof(uint8_t) * length_bytes);
     return res;
 }
 
+quill_string_t quill_string_from_temp_utf8(
+    const uint8_t *data, quill_int_t length_bytes
+) {
+    quill_int_t length_points = validated_length_points(data, length_bytes);
+    return quill_string_from_valid_utf8(data, length_bytes, length_points);
+}
+
+quill_string_t quill_string_from_temp_cstr(const char *cstr) {
+    return quill_string_from_temp_utf8(
+        (const uint8_t *) cstr, (quill_int_t) strlen(cstr)
+    );
+}
+
 char *quill_malloc_cstr_from_string(quill_string_t string) {
     char *buffer = malloc(string.length_bytes + 1);
-    memcpy(buffer, string.data, string.length_bytes);
+    memcpy(buffer, quill_string_data(&string), string.length_bytes);
     buffer[string.length_bytes] = '\0';
     return buffer;
 }
 
+static quill_string_t string_from_ascii(
+    const uint8_t *buffer, quill_int_t length_bytes
+) {
+    quill_string_t res;
+    uint8_t *dest = string_init(&res, length_bytes, length_bytes);
+    memcpy(dest, buffer, sizeof(uint8_t) * length_bytes);
+    return res;
+}
+
 quill_string_t quill_string_from_int(quill_int_t i) {
-    quill_int_t length_bytes = snprintf(NULL, 0, "%" PRIqd, i);
-    size_t buffer_size = (size_t) (sizeof(uint8_t) * (length_bytes + 1));
+    uint8_t buffer[QUILL_INT_FORMAT_MAX];
+    return string_from_ascii(buffer, quill_int_format(i, buffer));
+}
+
+quill_string_t quill_string_from_float(quill_float_t f) {
+    uint8_t buffer[QUILL_FLOAT_FORMAT_MAX];
+    return string_from_ascii(buffer, quill_float_format(f, buffer));
+}
+
+
+// Concatenations shorter than this are copied right away.
+#define MIN_ROPE_LENGTH 64
+
+typedef struct quill_rope {
+    quill_string_t left;
+    quill_string_t right;
+    // the contents of the entire rope, once they have been needed
+    _Atomic(quill_alloc_t *) flat;
+} quill_rope_t;
+
+quill_string_t quill_string_concat(quill_string_t a, quill_string_t b) {
+    if(b.length_bytes == 0) {
+        quill_string_rc_add(a);
+        return a;
+    }
+    if(a.length_bytes == 0) {
+        quill_string_rc_add(b);
+        return b;
+    }
+    quill_int_t length_bytes = a.length_bytes + b.length_bytes;
+    quill_int_t length_points = a.length_points + b.length_points;
     quill_string_t res;
-    res.length_points = length_bytes; // snprintf will only output ASCII
+    if(length_bytes < MIN_ROPE_LENGTH) {
+        uint8_t *dest = string_init(&res, length_bytes, length_points);
+        quill_string_copy_to(a, dest);
+        quill_string_copy_to(b, dest + a.length_bytes);
+        return res;
+    }
+    quill_string_rc_add(a);
+    quill_string_rc_add(b);
+    res.alloc = quill_malloc(sizeof(quill_rope_t), &quill_rope_free);
+    res.data = NULL;
     res.length_bytes = length_bytes;
-    res.alloc = quill_malloc(buffer_size, NULL);
-    res.data = res.alloc->data;
-    snprintf(res.alloc->data, buffer_size, "%" PRIqd, i);
+    res.length_points = length_points;
+    quill_rope_t *rope = (quill_rope_t *) res.alloc->data;
+    rope->left = a;
+    rope->right = b;
+    atomic_store_explicit(&rope->flat, NULL, memory_order_relaxed);
     return res;
 }
 
-static quill_int_t trimmed_float_str_length(
-    const uint8_t *data, quill_int_t og_length
+quill_unit_t quill_rope_free(quill_alloc_t *alloc) {
+    quill_rope_t *rope = (quill_rope_t *) alloc->data;
+    quill_string_rc_dec(rope->left);
+    quill_string_rc_dec(rope->right);
+    quill_rc_dec(atomic_load_explicit(&rope->flat, memory_order_acquire));
+    return QUILL_UNIT;
+}
+
+void quill_rope_traverse(
+    quill_alloc_t *alloc, quill_visit_t visit, void *context
 ) {
-    quill_int_t new_length = og_length;
-    while(new_length > 1 && data[new_length - 1] == '0') {
-        new_length -= 1;
+    quill_rope_t *rope = (quill_rope_t *) alloc->data;
+    const uint8_t *left = (const uint8_t *) &rope->left;
+    const uint8_t *right = (const uint8_t *) &rope->right;
+    quill_slot_visit(QUILL_ENV_SLOT_STRING, left, visit, context);
+    quill_slot_visit(QUILL_ENV_SLOT_STRING, right, visit, context);
+    visit(atomic_load_explicit(&rope->flat, memory_order_acquire), context);
+}
+
+// Returns NULL for ropes that haven't been flattened yet.
+static const uint8_t *piece_data(const quill_string_t *s) {
+    if(quill_string_is_inline(*s)) { return s->inline_data; }
+    if(s->data != NULL) { return s->data; }
+    quill_rope_t *rope = (quill_rope_t *) s->alloc->data;
+    quill_alloc_t *flat
+        = atomic_load_explicit(&rope->flat, memory_order_acquire);
+    return flat == NULL ? NULL : quill_string_alloc_bytes(flat);
+}
+
+static const quill_string_t **resize_pending(
+    const quill_string_t **pending, size_t capacity
+) {
+    pending = realloc(pending, sizeof(quill_string_t *) * capacity);
+    if(pending == NULL) {
+        quill_panic(quill_string_from_static_cstr(
+            "Unable to allocate memory\n"
+        ));
+    }
+    return pending;
+}
+
+void quill_string_copy_to(quill_string_t s, uint8_t *dest) {
+    const uint8_t *data = piece_data(&s);
+    if(data != NULL) {
+        memcpy(dest, data, sizeof(uint8_t) * s.length_bytes);
+        return;
     }
-    if(new_length > 1 && data[new_length - 1] == '.') {
-        new_length -= 1;
+    // ropes built by appending in a loop are as deep as they are long,
+    // so the pieces are visited using a stack instead of recursion
+    size_t capacity = 64;
+    const quill_string_t **pending = resize_pending(NULL, capacity);
+    pending[0] = &s;
+    size_t pending_c = 1;
+    while(pending_c > 0) {
+        pending_c -= 1;
+        const quill_string_t *piece = pending[pending_c];
+        data = piece_data(piece);
+        if(data != NULL) {
+            memcpy(dest, data, sizeof(uint8_t) * piece->length_bytes);
+            dest += piece->length_bytes;
+            continue;
+        }
+        if(pending_c + 2 > capacity) {
+            capacity *= 2;
+            pending = resize_pending(pending, capacity);
+        }
+        quill_rope_t *rope = (quill_rope_t *) piece->alloc->data;
+        pending[pending_c] = &rope->right;
+        pending[pending_c + 1] = &rope->left;
+        pending_c += 2;
     }
-    return new_length;
+    free(pending);
 }
 
-quill_string_t quill_string_from_float(quill_float_t f) {
-    if(isnan(f)) { 
-        return quill_string_from_static_cstr("nan"); 
+// The pieces of a flattened rope are no longer needed, but may still be
+// read by whoever else holds a reference to the rope (on other threads).
+// They are released once the caller holds the only reference, or the
+// only references are on this thread.
+static void release_pieces(quill_alloc_t *alloc, quill_rope_t *rope) {
+    if(quill_string_is_inline(rope->left)
+        && quill_string_is_inline(rope->right)) {
+        return;
     }
-    if(isinf(f)) { 
-        return f > 0? quill_string_from_static_cstr("inf")
-            : quill_string_from_static_cstr("-inf"); 
+    uint64_t rc = atomic_load_explicit(&alloc->rc, memory_order_relaxed);
+    quill_bool_t exclusive = (rc & QUILL_RC_COUNT_MASK) == 1;
+    #ifdef QUILL_THREAD_LOCAL_RC
+        exclusive |= (rc & (QUILL_RC_IMMORTAL | QUILL_RC_SHARED)) == 0;
+    #endif
+    if(!exclusive) { return; }
+    quill_string_t left = rope->left;
+    quill_string_t right = rope->right;
+    rope->left = QUILL_EMPTY_STRING;
+    rope->right = QUILL_EMPTY_STRING;
+    quill_string_rc_dec(left);
+    quill_string_rc_dec(right);
+}
+
+const uint8_t *quill_string_flatten(const quill_string_t *s) {
+    quill_rope_t *rope = (quill_rope_t *) s->alloc->data;
+    quill_alloc_t *flat
+        = atomic_load_explicit(&rope->flat, memory_order_acquire);
+    if(flat != NULL) {
+        release_pieces(s->alloc, rope);
+        return quill_string_alloc_bytes(flat);
+    }
+    flat = string_alloc(s->length_bytes, s->length_points);
+    quill_string_copy_to(*s, quill_string_alloc_bytes(flat));
+    // other threads may take references to the contents of shared ropes
+    uint64_t rc = atomic_load_explicit(&s->alloc->rc, memory_order_relaxed);
+    if((rc & QUILL_RC_SHARED) != 0) { quill_rc_share(flat); }
+    quill_alloc_t *found = NULL;
+    if(!atomic_compare_exchange_strong_explicit(
+        &rope->flat, &found, flat, memory_order_acq_rel, memory_order_acquire
+    )) {
+        // another thread flattened the rope at the same time
+        quill_alloc_free(flat);
+        return quill_string_alloc_bytes(found);
+    }
+    release_pieces(s->alloc, rope);
+    return quill_string_alloc_bytes(flat);
+}
+
+
+// Returns the header of the allocation holding the contents of 's',
+// which static strings and foreign allocations don't have.
+static quill_string_header_t *string_header(const quill_string_t *s) {
+    if(quill_string_is_inline(*s) || s->alloc == NULL) { return NULL; }
+    quill_alloc_t *alloc = s->alloc;
+    if(s->data == NULL) {
+        quill_string_flatten(s);
+        quill_rope_t *rope = (quill_rope_t *) s->alloc->data;
+        alloc = atomic_load_explicit(&rope->flat, memory_order_acquire);
+    }
+    if(!quill_string_has_header(alloc)) { return NULL; }
+    return (quill_string_header_t *) alloc->data;
+}
+
+// indexed by the high nibble of the first byte of a valid sequence
+static const uint8_t sequence_lengths[16] = {
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 3, 4
+};
+
+static size_t skip_points(const uint8_t *data, size_t offset, size_t n) {
+    for(size_t i = 0; i < n; i += 1) {
+        offset += sequence_lengths[data[offset] >> 4];
+    }
+    return offset;
+}
+
+static uint32_t *index_entries(quill_string_header_t *header) {
+    uint8_t *bytes = (uint8_t *) (header + 1);
+    return (uint32_t *) (bytes + index_start(header->length_bytes));
+}
+
+static size_t count_points(const uint8_t *data, size_t length_bytes) {
+    size_t length_points = 0;
+    for(size_t i = 0; i < length_bytes; i += 1) {
+        length_points += (data[i] & 0xC0 /* 11000000 */) != 0x80 /* 10000000 */;
+    }
+    return length_points;
+}
+
+// Returns the index of the code point starting at byte 'offset'
+// of the allocation, which must have a built index.
+static size_t point_of_offset(quill_string_header_t *header, size_t offset) {
+    const uint8_t *bytes = (const uint8_t *) (header + 1);
+    uint32_t *entries = index_entries(header);
+    // find the number of entries at or before 'offset'
+    size_t low = 0;
+    size_t high = header->index_entry_c;
+    while(low < high) {
+        size_t mid = low + (high - low) / 2;
+        if(entries[mid] <= offset) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    size_t from = low == 0 ? 0 : entries[low - 1];
+    return low * POINTS_PER_INDEX_ENTRY
+        + count_points(bytes + from, offset - from);
+}
+
+// Returns QUILL_FALSE if another thread is still building the index.
+static quill_bool_t ensure_index(quill_string_header_t *header) {
+    uint32_t state
+        = atomic_load_explicit(&header->index_state, memory_order_acquire);
+    if(state == INDEX_BUILT) { return QUILL_TRUE; }
+    if(state == INDEX_BUILDING) { return QUILL_FALSE; }
+    if(!atomic_compare_exchange_strong_explicit(
+        &header->index_state, &state, INDEX_BUILDING,
+        memory_order_acquire, memory_order_acquire
+    )) {
+        return state == INDEX_BUILT;
+    }
+    const uint8_t *bytes = (const uint8_t *) (header + 1);
+    uint32_t *entries = index_entries(header);
+    size_t offset = 0;
+    for(size_t i = 0; i < header->index_entry_c; i += 1) {
+        offset = skip_points(bytes, offset, POINTS_PER_INDEX_ENTRY);
+        entries[i] = (uint32_t) offset;
+    }
+    atomic_store_explicit(
+        &header->index_state, INDEX_BUILT, memory_order_release
+    );
+    return QUILL_TRUE;
+}
+
+quill_int_t quill_string_point_offset(
+    const quill_string_t *s, quill_int_t point_i
+) {
+    if(s->length_points == s->length_bytes) { return point_i; }
+    const uint8_t *data = quill_string_data(s);
+    quill_string_header_t *header = string_header(s);
+    if(s->length_bytes < MIN_INDEXED_LENGTH || header == NULL
+        || header->index_entry_c == 0 || !ensure_index(header)) {
+        return (quill_int_t) skip_points(data, 0, (size_t) point_i);
+    }
+    // slices use the index of the allocation they are a part of
+    const uint8_t *bytes = (const uint8_t *) (header + 1);
+    size_t start = (size_t) (data - bytes);
+    size_t target = (size_t) point_i;
+    if(start != 0) { target += point_of_offset(header, start); }
+    size_t entry_i = target / POINTS_PER_INDEX_ENTRY;
+    size_t offset = entry_i == 0 ? 0 : index_entries(header)[entry_i - 1];
+    offset = skip_points(bytes, offset, target % POINTS_PER_INDEX_ENTRY);
+    return (quill_int_t) (offset - start);
+}
+
+uint32_t quill_string_point_at(const quill_string_t *s, quill_int_t point_i) {
+    const uint8_t *data = quill_string_data(s);
+    return quill_point_decode(data + quill_string_point_offset(s, point_i));
+}
+
+
+// Slices shorter than 1/COMPACT_RATIO of an allocation of at least
+// MIN_COMPACT_LENGTH bytes are copied instead of keeping all of it alive.
+#define MIN_COMPACT_LENGTH 65536
+#define COMPACT_RATIO 64
+
+// Returns the allocation holding the contents of 's', which for ropes is
+// the one of the flattened contents.
+static quill_alloc_t *contents_alloc(const quill_string_t *s) {
+    if(s->data != NULL) { return s->alloc; }
+    quill_string_flatten(s);
+    quill_rope_t *rope = (quill_rope_t *) s->alloc->data;
+    return atomic_load_explicit(&rope->flat, memory_order_acquire);
+}
+
+static quill_string_t copy_slice(
+    const uint8_t *data, quill_int_t length_bytes, quill_int_t length_points
+) {
+    quill_string_t res;
+    uint8_t *dest = string_init(&res, length_bytes, length_points);
+    memcpy(dest, data, sizeof(uint8_t) * length_bytes);
+    return res;
+}
+
+static quill_string_t make_slice(
+    const quill_string_t *s, quill_int_t start_byte, quill_int_t end_byte,
+    quill_int_t length_points
+) {
+    const uint8_t *data = quill_string_data(s) + start_byte;
+    quill_int_t length_bytes = end_byte - start_byte;
+    if(length_bytes <= QUILL_STRING_INLINE_MAX) {
+        return copy_slice(data, length_bytes, length_points);
     }
-    quill_int_t length_bytes = snprintf(NULL, 0, "%" PRIqf, f);
-    size_t buffer_size = (size_t) (sizeof(uint8_t) * (length_bytes + 1));
     quill_string_t res;
-    res.alloc = quill_malloc(buffer_size, NULL);
-    res.data = res.alloc->data;
-    snprintf(res.alloc->data, buffer_size, "%" PRIqf, f);
-    quill_int_t length_trim = trimmed_float_str_length(res.data, length_bytes);
-    res.length_points = length_trim; // snprintf will only output ASCII
-    res.length_bytes = length_trim;
+    res.length_bytes = length_bytes;
+    res.length_points = length_points;
+    res.data = data;
+    // static strings never need to be kept alive
+    if(s->alloc == NULL) {
+        res.alloc = NULL;
+        return res;
+    }
+    quill_alloc_t *alloc = contents_alloc(s);
+    // the size of foreign allocations is unknown, so they are kept alive
+    uint64_t total = 0;
+    if(quill_string_has_header(alloc)) {
+        total = ((quill_string_header_t *) alloc->data)->length_bytes;
+    }
+    if(total >= MIN_COMPACT_LENGTH
+        && (uint64_t) length_bytes * COMPACT_RATIO < total) {
+        return copy_slice(data, length_bytes, length_points);
+    }
+    quill_rc_add(alloc);
+    res.alloc = alloc;
     return res;
-}
\ No newline at end of file
+}
+
+static void check_slice_bounds(
+    quill_int_t start, quill_int_t end, quill_int_t length
+) {
+    if(start < 0 || end < start || end > length) {
+        quill_panic(quill_string_from_static_cstr(
+            "String slice out of bounds\n"
+        ));
+    }
+}
+
+quill_string_t quill_string_slice(
+    quill_string_t s, quill_int_t start_point, quill_int_t end_point
+) {
+    check_slice_bounds(start_point, end_point, s.length_points);
+    quill_int_t start_byte = quill_string_point_offset(&s, start_point);
+    quill_int_t end_byte = quill_string_point_offset(&s, end_point);
+    return make_slice(&s, start_byte, end_byte, end_point - start_point);
+}
+
+quill_string_t quill_string_slice_bytes(
+    quill_string_t s, quill_int_t start_byte, quill_int_t end_byte
+) {
+    check_slice_bounds(start_byte, end_byte, s.length_bytes);
+    quill_int_t length_points = end_byte - start_byte;
+    if(s.length_points != s.length_bytes) {
+        // also rejects boundaries that are inside of a code point
+        length_points = quill_utf8_validate(
+            quill_string_data(&s) + start_byte, (size_t) length_points
+        );
+        if(length_points < 0) {
+            quill_panic(quill_string_from_static_cstr(
+                "String slice boundaries are not between code points\n"
+            ));
+        }
+    }
+    return make_slice(&s, start_byte, end_byte, length_points);
+}
+
+quill_string_t quill_string_compact(quill_string_t s) {
+    if(!quill_string_is_inline(s) && s.alloc != NULL && s.data != NULL) {
+        // foreign allocations may hold more than 's', which can't be told
+        quill_bool_t is_slice = !quill_string_has_header(s.alloc);
+        if(!is_slice) {
+            quill_string_header_t *header
+                = (quill_string_header_t *) s.alloc->data;
+            is_slice = s.data != quill_string_alloc_contents(s.alloc)
+                || (uint64_t) s.length_bytes != header->length_bytes;
+        }
+        if(is_slice) {
+            return copy_slice(s.data, s.length_bytes, s.length_points);
+        }
+    }
+    quill_string_rc_add(s);
+    return s;
+}
@@ -0,0 +1,668 @@
+#include <quill.h>
+#include <string.h>
+
+#if (defined(__GNUC__) || defined(__clang__)) \
+    && (defined(__x86_64__) || defined(__i386__))
+    #define HAS_X86_KERNELS
+    #include <immintrin.h>
+    #define TARGET_SSE42 __attribute__((target("sse4.2,popcnt")))
+    #define TARGET_AVX2 __attribute__((target("avx2,popcnt")))
+#endif
+
+typedef struct quill_utf8_kernels {
+    quill_int_t (*validate)(const uint8_t *data, size_t length_bytes);
+    quill_int_t (*length_of_points)(
+        const uint32_t *points, size_t length_points
+    );
+    void (*encode)(
+        const uint32_t *points, size_t length_points,
+        uint8_t *dest, size_t length_bytes
+    );
+    size_t (*decode)(const uint8_t *data, size_t length_bytes, uint32_t *dest);
+} quill_utf8_kernels_t;
+
+static quill_int_t validate_scalar(const uint8_t *data, size_t length) {
+    quill_int_t length_points = 0;
+    size_t i = 0;
+    while(i < length) {
+        if(length - i >= 8) {
+            uint64_t word;
+            memcpy(&word, data + i, sizeof(uint64_t));
+            if((word & 0x8080808080808080ULL) == 0) {
+                i += 8;
+                length_points += 8;
+                continue;
+            }
+        }
+        uint8_t start = data[i];
+        if(start < 0x80) {
+            i += 1;
+            length_points += 1;
+            continue;
+        }
+        size_t n;
+        uint32_t point;
+        uint32_t min_point;
+        if((start & 0xE0 /* 11100000 */) == 0xC0 /* 11000000 */) {
+            n = 2; point = start & 0x1F; min_point = 0x80;
+        } else if((start & 0xF0 /* 11110000 */) == 0xE0 /* 11100000 */) {
+            n = 3; point = start & 0x0F; min_point = 0x800;
+        } else if((start & 0xF8 /* 11111000 */) == 0xF0 /* 11110000 */) {
+            n = 4; point = start & 0x07; min_point = 0x10000;
+        } else {
+            return -1;
+        }
+        if(length - i < n) { return -1; }
+        for(size_t byte_i = 1; byte_i < n; byte_i += 1) {
+            uint8_t cont = data[i + byte_i];
+            if((cont & 0xC0 /* 11000000 */) != 0x80 /* 10000000 */) {
+                return -1;
+            }
+            point = (point << 6) | (cont & 0x3F /* 00111111 */);
+        }
+        if(point < min_point || point > 0x10FFFF) { return -1; }
+        if(point >= 0xD800 && point <= 0xDFFF) { return -1; }
+        i += n;
+        length_points += 1;
+    }
+    return length_points;
+}
+
+static quill_int_t length_of_points_scalar(
+    const uint32_t *points, size_t length_points
+) {
+    quill_int_t length_bytes = 0;
+    for(size_t i = 0; i < length_points; i += 1) {
+        uint32_t point = points[i];
+        if(point > 0x10FFFF) { return -1; }
+        if(point >= 0xD800 && point <= 0xDFFF) { return -1; }
+        length_bytes += 1 + (point > 0x7F) + (point > 0x7FF) + (point > 0xFFFF);
+    }
+    return length_bytes;
+}
+
+static void encode_scalar(
+    const uint32_t *points, size_t length_points,
+    uint8_t *dest, size_t length_bytes
+) {
+    (void) length_bytes;
+    for(size_t i = 0; i < length_points; i += 1) {
+        dest += quill_point_encode(points[i], dest);
+    }
+}
+
+// 'data' has already been validated, so nothing is checked here
+static size_t decode_point(const uint8_t *data, uint32_t *point) {
+    uint8_t start = data[0];
+    if(start < 0x80) {
+        *point = start;
+        return 1;
+    }
+    if(start < 0xE0) {
+        *point = ((uint32_t) (start & 0x1F) << 6) | (data[1] & 0x3F);
+        return 2;
+    }
+    if(start < 0xF0) {
+        *point = ((uint32_t) (start & 0x0F) << 12)
+            | ((uint32_t) (data[1] & 0x3F) << 6) | (data[2] & 0x3F);
+        return 3;
+    }
+    *point = ((uint32_t) (start & 0x07) << 18)
+        | ((uint32_t) (data[1] & 0x3F) << 12)
+        | ((uint32_t) (data[2] & 0x3F) << 6) | (data[3] & 0x3F);
+    return 4;
+}
+
+static size_t decode_scalar(
+    const uint8_t *data, size_t length_bytes, uint32_t *dest
+) {
+    size_t length_points = 0;
+    for(size_t i = 0; i < length_bytes; length_points += 1) {
+        i += decode_point(data + i, dest + length_points);
+    }
+    return length_points;
+}
+
+#ifdef HAS_X86_KERNELS
+    // Validation using the lookup algorithm by Keiser and Lemire ("Validating
+    // UTF-8 In Less Than One Instruction Per Byte"). Every byte is classified
+    // together with the one before it using three 16-entry tables, each bit
+    // standing for one kind of error. Where the tables agree on a bit that
+    // pair of bytes is invalid, except for the two continuations expected
+    // after the lead byte of a 3 or 4 byte sequence, which are checked
+    // separately. Code points are counted as bytes that aren't continuations.
+
+    #define TOO_SHORT (1 << 0)
+    #define TOO_LONG (1 << 1)
+    #define OVERLONG_3 (1 << 2)
+    #define TOO_LARGE (1 << 3)
+    #define SURROGATE (1 << 4)
+    #define OVERLONG_2 (1 << 5)
+    #define TOO_LARGE_1000 (1 << 6)
+    #define OVERLONG_4 (1 << 6)
+    #define TWO_CONTS (1 << 7)
+    #define CARRY (TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+    // indexed by the high nibble of the previous byte
+    static const uint8_t byte_1_high_table[16] = {
+        TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+        TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+        TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+        TOO_SHORT | OVERLONG_2,
+        TOO_SHORT,
+        TOO_SHORT | OVERLONG_3 | SURROGATE,
+        TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4
+    };
+
+    // indexed by the low nibble of the previous byte
+    static const uint8_t byte_1_low_table[16] = {
+        CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+        CARRY | OVERLONG_2,
+        CARRY,
+        CARRY,
+        CARRY | TOO_LARGE,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000
+    };
+
+    // indexed by the high nibble of the current byte
+    static const uint8_t byte_2_high_table[16] = {
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000
+            | OVERLONG_4,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT
+    };
+
+    // a block ending with the lead byte of an unfinished sequence
+    // has a byte above these values in one of its last three bytes
+    static const uint8_t incomplete_max[32] = {
+        255, 255, 255, 255, 255, 255, 255, 255,
+        255, 255, 255, 255, 255, 255, 255, 255,
+        255, 255, 255, 255, 255, 255, 255, 255,
+        255, 255, 255, 255, 255, 0xF0 - 1, 0xE0 - 1, 0xC0 - 1
+    };
+
+    TARGET_SSE42 static __m128i sse_lookup(const uint8_t *table, __m128i i) {
+        return _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) table), i);
+    }
+
+    TARGET_SSE42 static __m128i sse_check_block(
+        __m128i input, __m128i prev_input
+    ) {
+        __m128i nibble = _mm_set1_epi8(0x0F);
+        __m128i prev1 = _mm_alignr_epi8(input, prev_input, 15);
+        __m128i special = _mm_and_si128(
+            _mm_and_si128(
+                sse_lookup(byte_1_high_table, _mm_and_si128(
+                    _mm_srli_epi16(prev1, 4), nibble
+                )),
+                sse_lookup(byte_1_low_table, _mm_and_si128(prev1, nibble))
+            ),
+            sse_lookup(byte_2_high_table, _mm_and_si128(
+                _mm_srli_epi16(input, 4), nibble
+            ))
+        );
+        __m128i prev2 = _mm_alignr_epi8(input, prev_input, 14);
+        __m128i prev3 = _mm_alignr_epi8(input, prev_input, 13);
+        __m128i is_third = _mm_subs_epu8(prev2, _mm_set1_epi8(0xE0 - 0x80));
+        __m128i is_fourth = _mm_subs_epu8(prev3, _mm_set1_epi8(0xF0 - 0x80));
+        __m128i must_continue = _mm_and_si128(
+            _mm_or_si128(is_third, is_fourth), _mm_set1_epi8((char) 0x80)
+        );
+        return _mm_xor_si128(must_continue, special);
+    }
+
+    TARGET_SSE42 static quill_int_t validate_sse42(
+        const uint8_t *data, size_t length
+    ) {
+        __m128i error = _mm_setzero_si128();
+        __m128i prev_input = _mm_setzero_si128();
+        __m128i prev_incomplete = _mm_setzero_si128();
+        __m128i max = _mm_loadu_si128((const __m128i *) (incomplete_max + 16));
+        uint8_t tail[16];
+        quill_int_t length_points = 0;
+        for(size_t i = 0; i < length; i += 16) {
+            size_t rem = length - i;
+            __m128i input;
+            if(rem >= 16) {
+                input = _mm_loadu_si128((const __m128i *) (data + i));
+            } else {
+                // zeroes are ASCII, so they end any unfinished sequence
+                memset(tail, 0, sizeof(tail));
+                memcpy(tail, data + i, rem);
+                input = _mm_loadu_si128((const __m128i *) tail);
+            }
+            if(_mm_movemask_epi8(input) == 0) {
+                error = _mm_or_si128(error, prev_incomplete);
+                prev_incomplete = _mm_setzero_si128();
+            } else {
+                error = _mm_or_si128(error, sse_check_block(input, prev_input));
+                prev_incomplete = _mm_subs_epu8(input, max);
+            }
+            prev_input = input;
+            uint32_t starts = (uint32_t) _mm_movemask_epi8(
+                _mm_cmpgt_epi8(input, _mm_set1_epi8(-65))
+            );
+            if(rem < 16) { starts &= ((uint32_t) 1 << rem) - 1; }
+            length_points += __builtin_popcount(starts);
+        }
+        error = _mm_or_si128(error, prev_incomplete);
+        if(!_mm_testz_si128(error, error)) { return -1; }
+        return length_points;
+    }
+
+    TARGET_AVX2 static __m256i avx2_lookup(const uint8_t *table, __m256i i) {
+        __m256i t = _mm256_broadcastsi128_si256(
+            _mm_loadu_si128((const __m128i *) table)
+        );
+        return _mm256_shuffle_epi8(t, i);
+    }
+
+    // shifts in the last bytes of 'prev_input' across the 128 bit lanes
+    #define AVX2_PREV(input, prev_input, n) _mm256_alignr_epi8( \
+        (input), _mm256_permute2x128_si256((prev_input), (input), 0x21), \
+        16 - (n) \
+    )
+
+    TARGET_AVX2 static __m256i avx2_check_block(
+        __m256i input, __m256i prev_input
+    ) {
+        __m256i nibble = _mm256_set1_epi8(0x0F);
+        __m256i prev1 = AVX2_PREV(input, prev_input, 1);
+        __m256i special = _mm256_and_si256(
+            _mm256_and_si256(
+                avx2_lookup(byte_1_high_table, _mm256_and_si256(
+                    _mm256_srli_epi16(prev1, 4), nibble
+                )),
+                avx2_lookup(byte_1_low_table, _mm256_and_si256(prev1, nibble))
+            ),
+            avx2_lookup(byte_2_high_table, _mm256_and_si256(
+                _mm256_srli_epi16(input, 4), nibble
+            ))
+        );
+        __m256i prev2 = AVX2_PREV(input, prev_input, 2);
+        __m256i prev3 = AVX2_PREV(input, prev_input, 3);
+        __m256i is_third = _mm256_subs_epu8(
+            prev2, _mm256_set1_epi8(0xE0 - 0x80)
+        );
+        __m256i is_fourth = _mm256_subs_epu8(
+            prev3, _mm256_set1_epi8(0xF0 - 0x80)
+        );
+        __m256i must_continue = _mm256_and_si256(
+            _mm256_or_si256(is_third, is_fourth),
+            _mm256_set1_epi8((char) 0x80)
+        );
+        return _mm256_xor_si256(must_continue, special);
+    }
+
+    TARGET_AVX2 static quill_int_t validate_avx2(
+        const uint8_t *data, size_t length
+    ) {
+        __m256i error = _mm256_setzero_si256();
+        __m256i prev_input = _mm256_setzero_si256();
+        __m256i prev_incomplete = _mm256_setzero_si256();
+        __m256i max = _mm256_loadu_si256((const __m256i *) incomplete_max);
+        uint8_t tail[32];
+        quill_int_t length_points = 0;
+        for(size_t i = 0; i < length; i += 32) {
+            size_t rem = length - i;
+            __m256i input;
+            if(rem >= 32) {
+                input = _mm256_loadu_si256((const __m256i *) (data + i));
+            } else {
+                // zeroes are ASCII, so they end any unfinished sequence
+                memset(tail, 0, sizeof(tail));
+                memcpy(tail, data + i, rem);
+                input = _mm256_loadu_si256((const __m256i *) tail);
+            }
+            if(_mm256_movemask_epi8(input) == 0) {
+                error = _mm256_or_si256(error, prev_incomplete);
+                prev_incomplete = _mm256_setzero_si256();
+            } else {
+                error = _mm256_or_si256(
+                    error, avx2_check_block(input, prev_input)
+                );
+                prev_incomplete = _mm256_subs_epu8(input, max);
+            }
+            prev_input = input;
+            uint32_t starts = (uint32_t) _mm256_movemask_epi8(
+                _mm256_cmpgt_epi8(input, _mm256_set1_epi8(-65))
+            );
+            if(rem < 32) { starts &= ((uint32_t) 1 << rem) - 1; }
+            length_points += __builtin_popcount(starts);
+        }
+        error = _mm256_or_si256(error, prev_incomplete);
+        if(!_mm256_testz_si256(error, error)) { return -1; }
+        return length_points;
+    }
+
+    // Encoding turns four points below 0x10000 into one 32 bit lane each,
+    // holding up to three bytes. A shuffle selected by which lanes need
+    // more than one or two bytes then packs them together.
+    typedef struct quill_utf8_pack {
+        uint8_t shuffle[16];
+        uint8_t length;
+    } quill_utf8_pack_t;
+
+    static quill_utf8_pack_t encode_packs[256];
+
+    // Decoding takes the positions of the bytes starting a point among the
+    // next 12 bytes, and if the first four points take at most 3 bytes
+    // each, shuffles each into a lane of its own in reverse byte order.
+    // The last of them is assumed to end where the next point starts or at
+    // the 12th byte, which is checked against the byte after it.
+    static quill_utf8_pack_t decode_packs[4096];
+
+    static void init_encode_packs(void) {
+        for(size_t mask = 0; mask < 256; mask += 1) {
+            quill_utf8_pack_t *pack = &encode_packs[mask];
+            size_t length = 0;
+            for(size_t lane = 0; lane < 4; lane += 1) {
+                size_t lane_length = 1 + ((mask >> lane) & 1)
+                    + ((mask >> (lane + 4)) & 1);
+                for(size_t byte_i = 0; byte_i < lane_length; byte_i += 1) {
+                    pack->shuffle[length] = (uint8_t) (lane * 4 + byte_i);
+                    length += 1;
+                }
+            }
+            pack->length = (uint8_t) length;
+            for(size_t i = length; i < 16; i += 1) {
+                pack->shuffle[i] = 0x80;
+            }
+        }
+    }
+
+    static void init_decode_packs(void) {
+        for(size_t mask = 0; mask < 4096; mask += 1) {
+            quill_utf8_pack_t *pack = &decode_packs[mask];
+            pack->length = 0;
+            if((mask & 1) == 0) { continue; }
+            size_t starts[5];
+            size_t start_c = 0;
+            for(size_t i = 0; i < 12 && start_c < 5; i += 1) {
+                if(((mask >> i) & 1) == 0) { continue; }
+                starts[start_c] = i;
+                start_c += 1;
+            }
+            if(start_c < 4) { continue; }
+            if(start_c == 4) { starts[4] = 12; }
+            quill_bool_t fits = QUILL_TRUE;
+            for(size_t lane = 0; lane < 4; lane += 1) {
+                size_t start = starts[lane];
+                size_t end = starts[lane + 1];
+                if(end - start > 3) { fits = QUILL_FALSE; }
+                for(size_t byte_i = 0; byte_i < 4; byte_i += 1) {
+                    pack->shuffle[lane * 4 + byte_i] = byte_i < end - start
+                        ? (uint8_t) (end - 1 - byte_i) : 0x80;
+                }
+            }
+            if(fits) { pack->length = (uint8_t) starts[4]; }
+        }
+    }
+
+    TARGET_SSE42 static quill_int_t length_of_points_sse42(
+        const uint32_t *points, size_t length_points
+    ) {
+        quill_int_t length_bytes = 0;
+        __m128i invalid = _mm_setzero_si128();
+        size_t i = 0;
+        while(i + 4 <= length_points) {
+            // flushed before the 32 bit lanes could overflow
+            size_t end = length_points - i > ((size_t) 1 << 24)
+                ? i + ((size_t) 1 << 24) : length_points;
+            __m128i counts = _mm_setzero_si128();
+            for(; i + 4 <= end; i += 4) {
+                __m128i p = _mm_loadu_si128((const __m128i *) (points + i));
+                __m128i max = _mm_min_epu32(p, _mm_set1_epi32(0x10FFFF));
+                __m128i surrogate = _mm_cmpeq_epi32(
+                    _mm_and_si128(p, _mm_set1_epi32(0xFFFFF800)),
+                    _mm_set1_epi32(0xD800)
+                );
+                invalid = _mm_or_si128(invalid, _mm_or_si128(
+                    _mm_xor_si128(p, max), surrogate
+                ));
+                // comparisons give -1 for every additional byte
+                counts = _mm_sub_epi32(counts, _mm_add_epi32(
+                    _mm_add_epi32(
+                        _mm_cmpgt_epi32(max, _mm_set1_epi32(0x7F)),
+                        _mm_cmpgt_epi32(max, _mm_set1_epi32(0x7FF))
+                    ),
+                    _mm_cmpgt_epi32(max, _mm_set1_epi32(0xFFFF))
+                ));
+            }
+            uint32_t lanes[4];
+            _mm_storeu_si128((__m128i *) lanes, counts);
+            length_bytes += (quill_int_t) lanes[0] + lanes[1] + lanes[2]
+                + lanes[3];
+        }
+        if(!_mm_testz_si128(invalid, invalid)) { return -1; }
+        quill_int_t rest = length_of_points_scalar(
+            points + i, length_points - i
+        );
+        if(rest < 0) { return -1; }
+        return length_bytes + (quill_int_t) (i + rest);
+    }
+
+    TARGET_SSE42 static void encode_sse42(
+        const uint32_t *points, size_t length_points,
+        uint8_t *dest, size_t length_bytes
+    ) {
+        size_t i = 0;
+        size_t o = 0;
+        // every store writes 16 bytes, even if fewer are used
+        while(i + 16 <= length_points && o + 16 <= length_bytes) {
+            const __m128i *src = (const __m128i *) (points + i);
+            __m128i p0 = _mm_loadu_si128(src);
+            __m128i p1 = _mm_loadu_si128(src + 1);
+            __m128i p2 = _mm_loadu_si128(src + 2);
+            __m128i p3 = _mm_loadu_si128(src + 3);
+            __m128i all = _mm_or_si128(_mm_or_si128(p0, p1), _mm_or_si128(p2, p3));
+            if(_mm_testz_si128(all, _mm_set1_epi32(~0x7F))) {
+                __m128i bytes = _mm_packus_epi16(
+                    _mm_packus_epi32(p0, p1), _mm_packus_epi32(p2, p3)
+                );
+                _mm_storeu_si128((__m128i *) (dest + o), bytes);
+                i += 16;
+                o += 16;
+                continue;
+            }
+            if(!_mm_testz_si128(p0, _mm_set1_epi32(~0xFFFF))) {
+                for(size_t end = i + 4; i < end; i += 1) {
+                    o += (size_t) quill_point_encode(points[i], dest + o);
+                }
+                continue;
+            }
+            __m128i low6 = _mm_set1_epi32(0x3F);
+            __m128i cont = _mm_set1_epi32(0x80);
+            __m128i two = _mm_or_si128(
+                _mm_or_si128(_mm_srli_epi32(p0, 6), _mm_set1_epi32(0xC0)),
+                _mm_slli_epi32(_mm_or_si128(_mm_and_si128(p0, low6), cont), 8)
+            );
+            __m128i three = _mm_or_si128(
+                _mm_or_si128(_mm_srli_epi32(p0, 12), _mm_set1_epi32(0xE0)),
+                _mm_or_si128(
+                    _mm_slli_epi32(_mm_or_si128(
+                        _mm_and_si128(_mm_srli_epi32(p0, 6), low6), cont
+                    ), 8),
+                    _mm_slli_epi32(
+                        _mm_or_si128(_mm_and_si128(p0, low6), cont), 16
+                    )
+                )
+            );
+            __m128i is_two = _mm_cmpgt_epi32(p0, _mm_set1_epi32(0x7F));
+            __m128i is_three = _mm_cmpgt_epi32(p0, _mm_set1_epi32(0x7FF));
+            __m128i lanes = _mm_blendv_epi8(
+                _mm_blendv_epi8(p0, two, is_two), three, is_three
+            );
+            size_t mask = (size_t) _mm_movemask_ps(_mm_castsi128_ps(is_two))
+                | ((size_t) _mm_movemask_ps(_mm_castsi128_ps(is_three)) << 4);
+            quill_utf8_pack_t *pack = &encode_packs[mask];
+            __m128i bytes = _mm_shuffle_epi8(
+                lanes, _mm_loadu_si128((const __m128i *) pack->shuffle)
+            );
+            _mm_storeu_si128((__m128i *) (dest + o), bytes);
+            i += 4;
+            o += pack->length;
+        }
+        encode_scalar(points + i, length_points - i, dest + o, length_bytes - o);
+    }
+
+    TARGET_SSE42 static size_t decode_sse42(
+        const uint8_t *data, size_t length_bytes, uint32_t *dest
+    ) {
+        size_t i = 0;
+        size_t o = 0;
+        while(i + 16 <= length_bytes) {
+            __m128i input = _mm_loadu_si128((const __m128i *) (data + i));
+            if(_mm_movemask_epi8(input) == 0) {
+                __m128i *out = (__m128i *) (dest + o);
+                _mm_storeu_si128(out, _mm_cvtepu8_epi32(input));
+                _mm_storeu_si128(out + 1, _mm_cvtepu8_epi32(
+                    _mm_srli_si128(input, 4)
+                ));
+                _mm_storeu_si128(out + 2, _mm_cvtepu8_epi32(
+                    _mm_srli_si128(input, 8)
+                ));
+                _mm_storeu_si128(out + 3, _mm_cvtepu8_epi32(
+                    _mm_srli_si128(input, 12)
+                ));
+                i += 16;
+                o += 16;
+                continue;
+            }
+            size_t starts = (size_t) _mm_movemask_epi8(
+                _mm_cmpgt_epi8(input, _mm_set1_epi8(-65))
+            );
+            quill_utf8_pack_t *pack = &decode_packs[starts & 0xFFF];
+            if(pack->length == 0 || ((starts >> pack->length) & 1) == 0) {
+                i += decode_point(data + i, dest + o);
+                o += 1;
+                continue;
+            }
+            __m128i t = _mm_shuffle_epi8(
+                input, _mm_loadu_si128((const __m128i *) pack->shuffle)
+            );
+            // last byte in the lowest position, lead byte bits are dropped
+            // by the masks (the bit below the prefix is always zero)
+            __m128i points = _mm_or_si128(
+                _mm_and_si128(t, _mm_set1_epi32(0x7F)),
+                _mm_or_si128(
+                    _mm_and_si128(_mm_srli_epi32(t, 2), _mm_set1_epi32(0xFC0)),
+                    _mm_and_si128(_mm_srli_epi32(t, 4), _mm_set1_epi32(0xF000))
+                )
+            );
+            _mm_storeu_si128((__m128i *) (dest + o), points);
+            i += pack->length;
+            o += 4;
+        }
+        return o + decode_scalar(data + i, length_bytes - i, dest + o);
+    }
+#endif
+
+static const quill_utf8_kernels_t scalar_kernels = {
+    .validate = &validate_scalar,
+    .length_of_points = &length_of_points_scalar,
+    .encode = &encode_scalar,
+    .decode = &decode_scalar
+};
+
+#ifdef HAS_X86_KERNELS
+    static const quill_utf8_kernels_t sse42_kernels = {
+        .validate = &validate_sse42,
+        .length_of_points = &length_of_points_sse42,
+        .encode = &encode_sse42,
+        .decode = &decode_sse42
+    };
+
+    static const quill_utf8_kernels_t avx2_kernels = {
+        .validate = &validate_avx2,
+        .length_of_points = &length_of_points_sse42,
+        .encode = &encode_sse42,
+        .decode = &decode_sse42
+    };
+#endif
+
+static _Atomic(const quill_utf8_kernels_t *) utf8_kernels = NULL;
+static atomic_flag selecting_kernels = ATOMIC_FLAG_INIT;
+
+static const quill_utf8_kernels_t *select_kernels(void) {
+    #ifdef HAS_X86_KERNELS
+        __builtin_cpu_init();
+        int avx2 = __builtin_cpu_supports("avx2");
+        if(avx2 || __builtin_cpu_supports("sse4.2")) {
+            init_encode_packs();
+            init_decode_packs();
+            return avx2 ? &avx2_kernels : &sse42_kernels;
+        }
+    #endif
+    return &scalar_kernels;
+}
+
+static const quill_utf8_kernels_t *get_kernels(void) {
+    const quill_utf8_kernels_t *kernels
+        = atomic_load_explicit(&utf8_kernels, memory_order_acquire);
+    if(kernels != NULL) { return kernels; }
+    // the tables must only be filled in once
+    while(atomic_flag_test_and_set_explicit(
+        &selecting_kernels, memory_order_acquire
+    )) {}
+    kernels = atomic_load_explicit(&utf8_kernels, memory_order_acquire);
+    if(kernels == NULL) {
+        kernels = select_kernels();
+        atomic_store_explicit(&utf8_kernels, kernels, memory_order_release);
+    }
+    atomic_flag_clear_explicit(&selecting_kernels, memory_order_release);
+    return kernels;
+}
+
+// Inputs this short aren't worth setting up the vector registers for.
+#define MIN_KERNEL_LENGTH 16
+
+quill_int_t quill_utf8_validate(const uint8_t *data, size_t length_bytes) {
+    if(length_bytes < MIN_KERNEL_LENGTH) {
+        return validate_scalar(data, length_bytes);
+    }
+    return get_kernels()->validate(data, length_bytes);
+}
+
+quill_int_t quill_utf8_length_of_points(
+    const uint32_t *points, size_t length_points
+) {
+    if(length_points < MIN_KERNEL_LENGTH) {
+        return length_of_points_scalar(points, length_points);
+    }
+    return get_kernels()->length_of_points(points, length_points);
+}
+
+void quill_utf8_encode(
+    const uint32_t *points, size_t length_points,
+    uint8_t *dest, size_t length_bytes
+) {
+    if(length_points < MIN_KERNEL_LENGTH) {
+        encode_scalar(points, length_points, dest, length_bytes);
+        return;
+    }
+    get_kernels()->encode(points, length_points, dest, length_bytes);
+}
+
+size_t quill_utf8_decode(
+    const uint8_t *data, size_t length_bytes, uint32_t *dest
+) {
+    if(length_bytes < MIN_KERNEL_LENGTH) {
+        return decode_scalar(data, length_bytes, dest);
+    }
+    return get_kernels()->decode(data, length_bytes, dest);
+}